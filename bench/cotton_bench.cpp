@@ -0,0 +1,373 @@
+#include "box.hpp"
+#include "logger.hpp"
+#include "util.hpp"
+#include <option.hpp>
+#include <positional.hpp>
+#include <command.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <iomanip>
+#include <memory>
+#include <sstream>
+#include <vector>
+#ifdef COTTON_UNIX
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+BoxCreators* box_creators;
+CottonLogger* logger;
+
+namespace {
+
+// Every run goes through all the phases, in this order. Phases that a
+// backend does not support take no time.
+enum phase_t {create, limits, run, stats, clear, destroy, cycle, num_phases};
+const char* const phase_names[num_phases] = {"create", "limits", "run", "stats", "clear", "destroy", "cycle"};
+const double percentiles[] = {0.5, 0.9, 0.99};
+const size_t num_percentiles = sizeof percentiles / sizeof percentiles[0];
+
+struct sample_t {
+    double us[num_phases];
+    int32_t ok;
+};
+
+struct result_t {
+    std::string backend;
+    int concurrency;
+    size_t runs;
+    size_t failures;
+    double runs_per_sec;
+    double latency[num_phases][num_percentiles];
+};
+
+double now_us() {
+    using namespace std::chrono;
+    return duration_cast<duration<double, std::micro>>(steady_clock::now().time_since_epoch()).count();
+}
+
+bool write_file(const std::string& path, const std::string& data) {
+    int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0755);
+    if (fd == -1) return false;
+    bool ok = write(fd, data.data(), data.size()) == (ssize_t)data.size();
+    return close(fd) == 0 && ok;
+}
+
+// Creates, runs and destroys a box for each of the given runs, in this
+// process, and sends back the latency of every phase.
+[[noreturn]] void worker(const std::string& backend, const std::string& box_root, const std::string& program,
+    size_t runs, int sock) {
+    std::string last_error;
+    callback_t on_error = [&last_error] (int code, const std::string& err) {
+        last_error = "Error " + std::to_string(code) + ": " + err;
+    };
+    callback_t on_warning = [] (int code, const std::string& warn) {};
+    std::vector<sample_t> samples(runs);
+    for (auto& s: samples) {
+        s = {};
+        std::unique_ptr<Sandbox> box((*box_creators)[backend](box_root));
+        box->set_error_handler(on_error);
+        box->set_warning_handler(on_warning);
+        Sandbox::feature_mask_t features = box->get_features();
+        double last = now_us();
+        auto lap = [&s, &last] (phase_t phase) {
+            double now = now_us();
+            s.us[phase] = now - last;
+            s.us[cycle] += now - last;
+            last = now;
+        };
+        if (box->create_box() == 0) continue;
+        lap(create);
+        bool ok = true;
+        if (features & Sandbox::memory_limit) ok = ok && box->set_memory_limit(space_limit_t(65536));
+        if (features & Sandbox::cpu_limit) ok = ok && box->set_time_limit(time_limit_t(1));
+        if (features & Sandbox::wall_time_limit) ok = ok && box->set_wall_time_limit(time_limit_t(2));
+        lap(limits);
+        // Putting the program in the box is not part of the measure.
+        ok = ok && write_file(box->get_root() + "noop", program);
+        last = now_us();
+        ok = ok && box->run("noop", {});
+        lap(run);
+        if (ok) {
+            RunResult res = box->get_run_result();
+            if (features & Sandbox::return_code && res.return_code != 0) {
+                last_error = "The program returned " + std::to_string(res.return_code);
+                ok = false;
+            }
+        }
+        lap(stats);
+        if (ok && features & Sandbox::clearable) ok = box->clear();
+        lap(clear);
+        ok = box->delete_box() && ok;
+        lap(destroy);
+        s.ok = ok;
+    }
+    if (!last_error.empty()) std::cerr << backend << ": " << last_error << std::endl;
+    uint64_t count = samples.size();
+    send_all(sock, &count, sizeof count);
+    send_all(sock, samples.data(), count * sizeof(sample_t));
+    _exit(0);
+}
+
+// Runs the given number of runs split over concurrency processes.
+bool bench(const std::string& backend, const std::string& box_root, const std::string& program,
+    size_t runs, int concurrency, result_t& result) {
+    std::vector<std::pair<pid_t, int>> workers;
+    double start = now_us();
+    for (int i=0; i<concurrency; i++) {
+        int sv[2];
+        if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv) == -1) {
+            std::cerr << serror("Cannot create a socket") << std::endl;
+            break;
+        }
+        size_t worker_runs = runs / concurrency + ((size_t)i < runs % concurrency);
+        pid_t pid = fork();
+        if (pid == 0) {
+            close(sv[0]);
+            worker(backend, box_root, program, worker_runs, sv[1]);
+        }
+        close(sv[1]);
+        if (pid == -1) {
+            std::cerr << serror("Cannot start a worker") << std::endl;
+            close(sv[0]);
+            break;
+        }
+        workers.emplace_back(pid, sv[0]);
+    }
+    std::vector<sample_t> samples;
+    for (auto& w: workers) {
+        uint64_t count;
+        if (read_all(w.second, &count, sizeof count)) {
+            size_t old_size = samples.size();
+            samples.resize(old_size + count);
+            if (!read_all(w.second, samples.data() + old_size, count * sizeof(sample_t)))
+                samples.resize(old_size);
+        }
+        close(w.second);
+        while (waitpid(w.first, nullptr, 0) == -1 && errno == EINTR);
+    }
+    double elapsed = now_us() - start;
+    if ((int)workers.size() != concurrency) return false;
+    result.backend = backend;
+    result.concurrency = concurrency;
+    result.runs = 0;
+    result.failures = runs;
+    std::vector<double> latencies[num_phases];
+    for (const auto& s: samples) {
+        if (!s.ok) continue;
+        result.runs++;
+        result.failures--;
+        for (int p=0; p<num_phases; p++) latencies[p].push_back(s.us[p]);
+    }
+    result.runs_per_sec = result.runs / elapsed * 1e6;
+    for (int p=0; p<num_phases; p++) {
+        std::sort(latencies[p].begin(), latencies[p].end());
+        for (size_t i=0; i<num_percentiles; i++) {
+            size_t pos = std::min(latencies[p].size() - 1, (size_t)(percentiles[i] * latencies[p].size()));
+            result.latency[p][i] = latencies[p].empty() ? 0 : latencies[p][pos];
+        }
+    }
+    return true;
+}
+
+std::string percentile_name(size_t i) {
+    return "p" + std::to_string((int)std::round(percentiles[i] * 100));
+}
+
+void print_result(const result_t& r) {
+    std::cout << r.backend << ", " << r.concurrency << (r.concurrency == 1 ? " box" : " boxes") << ": "
+        << std::fixed << std::setprecision(1) << r.runs_per_sec << " runs/s, "
+        << r.runs << " runs, " << r.failures << " failures" << std::endl;
+    std::cout << "  " << std::setw(8) << std::left << "phase" << std::right;
+    for (size_t i=0; i<num_percentiles; i++) std::cout << std::setw(12) << percentile_name(i) + " (us)";
+    std::cout << std::endl;
+    for (int p=0; p<num_phases; p++) {
+        std::cout << "  " << std::setw(8) << std::left << phase_names[p] << std::right;
+        for (size_t i=0; i<num_percentiles; i++) std::cout << std::setw(12) << r.latency[p][i];
+        std::cout << std::endl;
+    }
+}
+
+// The results are stored one metric per line, as "backend concurrency metric
+// value", so that baselines can be diffed and edited by hand.
+typedef std::map<std::tuple<std::string, int, std::string>, double> metrics_t;
+
+metrics_t to_metrics(const std::vector<result_t>& results) {
+    metrics_t metrics;
+    for (const auto& r: results) {
+        metrics[std::make_tuple(r.backend, r.concurrency, "runs_per_sec")] = r.runs_per_sec;
+        for (int p=0; p<num_phases; p++)
+            for (size_t i=0; i<num_percentiles; i++)
+                metrics[std::make_tuple(r.backend, r.concurrency, std::string(phase_names[p]) + "." + percentile_name(i))] =
+                    r.latency[p][i];
+    }
+    return metrics;
+}
+
+bool save_metrics(const std::string& file, const metrics_t& metrics) {
+    std::ofstream fout(file);
+    for (const auto& m: metrics)
+        fout << std::get<0>(m.first) << " " << std::get<1>(m.first) << " " << std::get<2>(m.first) << " "
+            << std::fixed << std::setprecision(3) << m.second << "\n";
+    return (bool)fout;
+}
+
+bool load_metrics(const std::string& file, metrics_t& metrics) {
+    std::ifstream fin(file);
+    if (!fin) return false;
+    std::string line;
+    while (std::getline(fin, line)) {
+        std::istringstream in(line);
+        std::string backend, metric;
+        int concurrency;
+        double value;
+        if (in >> backend >> concurrency >> metric >> value)
+            metrics[std::make_tuple(backend, concurrency, metric)] = value;
+    }
+    return true;
+}
+
+// Compares the throughput and the median latencies, which are stable enough
+// to be checked automatically. Returns the number of regressions.
+size_t compare_metrics(const metrics_t& baseline, const metrics_t& current, double tolerance) {
+    size_t regressions = 0;
+    for (const auto& m: current) {
+        const std::string& metric = std::get<2>(m.first);
+        bool higher_is_better = metric == "runs_per_sec";
+        if (!higher_is_better && metric.substr(metric.size() - 4) != ".p50") continue;
+        auto base = baseline.find(m.first);
+        if (base == baseline.end() || base->second == 0) continue;
+        double change = (m.second - base->second) / base->second * 100;
+        if (higher_is_better ? change >= -tolerance : change <= tolerance) continue;
+        regressions++;
+        std::cout << "REGRESSION " << std::get<0>(m.first) << " " << std::get<1>(m.first) << " " << metric
+            << ": " << std::fixed << std::setprecision(1) << base->second << " -> " << m.second
+            << " (" << std::showpos << change << std::noshowpos << "%)" << std::endl;
+    }
+    return regressions;
+}
+
+std::string default_program() {
+    char buf[4096];
+    ssize_t len = readlink("/proc/self/exe", buf, sizeof buf - 1);
+    if (len <= 0) return "cotton-noop";
+    std::string self(buf, len);
+    return self.substr(0, self.rfind('/') + 1) + "cotton-noop";
+}
+
+} // namespace
+
+namespace program_options {
+
+DEFINE_OPTION(help, "print this message", 'h');
+DEFINE_OPTION(box_root, "folder to put the sandboxes in", 'r');
+DEFINE_OPTION(backend, "only benchmark this implementation", 'b');
+DEFINE_OPTION(runs, "number of runs for every concurrency level", 'n');
+DEFINE_OPTION(concurrency, "benchmark from 1 up to this many boxes in parallel", 'c');
+DEFINE_OPTION(program, "statically linked program to run, cotton-noop by default", 'p');
+DEFINE_OPTION(save, "save the results to a file", 's');
+DEFINE_OPTION(baseline, "compare the results with the ones saved in a file", 'B');
+DEFINE_OPTION(tolerance, "slowdown allowed by the comparison, in percent", 't');
+
+DEFINE_COMMAND(cotton_bench, "Measures the create/run/clear/destroy throughput of the cotton sandboxes",
+    option<_help, void>(),
+    option<_box_root, const char*>("/tmp/cotton-bench"),
+    option<_backend, const char*>(),
+    option<_runs, int>(200),
+    option<_concurrency, int>(1),
+    option<_program, const char*>(),
+    option<_save, const char*>(),
+    option<_baseline, const char*>(),
+    option<_tolerance, double>(10));
+
+int exit_status = 0;
+
+template<>
+void command_callback(const decltype(cotton_bench_command)& bc) {
+    if (bc.has_option<_help>()) {
+        bc.print_help(std::cerr);
+        exit(0);
+    }
+    std::string box_root = bc.get_option<_box_root>();
+    int runs = bc.get_option<_runs>();
+    int concurrency = bc.get_option<_concurrency>();
+    if (runs <= 0 || concurrency <= 0) {
+        std::cerr << "The number of runs and the concurrency must be positive" << std::endl;
+        exit_status = 2;
+        return;
+    }
+    if (mkdirs(box_root, 0755) == -1) {
+        std::cerr << serror("Cannot create " + box_root) << std::endl;
+        exit_status = 2;
+        return;
+    }
+    std::string program_path = bc.has_option<_program>() ? bc.get_option<_program>() : default_program();
+    std::ifstream program_file(program_path, std::ios::binary);
+    std::string program((std::istreambuf_iterator<char>(program_file)), std::istreambuf_iterator<char>());
+    if (!program_file || program.empty()) {
+        std::cerr << "Cannot read " << program_path << std::endl;
+        exit_status = 2;
+        return;
+    }
+    std::vector<std::string> backends;
+    for (const auto& creator: *box_creators) {
+        if (bc.has_option<_backend>() && creator.first != bc.get_option<_backend>()) continue;
+        std::unique_ptr<Sandbox> box(creator.second(box_root));
+        if (box->is_available()) backends.push_back(creator.first);
+        else std::cerr << creator.first << " is not available, skipping it" << std::endl;
+    }
+    if (backends.empty()) {
+        std::cerr << "No implementation to benchmark" << std::endl;
+        exit_status = 2;
+        return;
+    }
+    std::vector<result_t> results;
+    for (const auto& backend: backends) {
+        for (int c=1; c<=concurrency; c++) {
+            result_t result;
+            if (!bench(backend, box_root, program, runs, c, result)) {
+                exit_status = 2;
+                return;
+            }
+            print_result(result);
+            if (result.failures != 0) exit_status = 1;
+            results.push_back(result);
+        }
+    }
+    metrics_t metrics = to_metrics(results);
+    if (bc.has_option<_save>() && !save_metrics(bc.get_option<_save>(), metrics)) {
+        std::cerr << "Cannot write " << bc.get_option<_save>() << std::endl;
+        exit_status = 2;
+    }
+    if (bc.has_option<_baseline>()) {
+        metrics_t baseline;
+        if (!load_metrics(bc.get_option<_baseline>(), baseline)) {
+            std::cerr << "Cannot read " << bc.get_option<_baseline>() << std::endl;
+            exit_status = 2;
+            return;
+        }
+        if (compare_metrics(baseline, metrics, bc.get_option<_tolerance>()) != 0) exit_status = 1;
+    }
+}
+
+} // namespace program_options
+
+int main(int argc, const char** argv) {
+#ifdef COTTON_UNIX
+    // Same as cotton: drop privileges if setuid, the boxes take them back.
+    setreuid(geteuid(), getuid());
+#endif
+    logger = new CottonTTYLogger;
+    try {
+        program_options::cotton_bench_command.parse(argc, argv);
+    } catch (std::exception& e) {
+        std::cerr << "Unhandled exception! " << e.what() << std::endl;
+        return 2;
+    }
+    return program_options::exit_status;
+}
@@ -0,0 +1,5 @@
+/* Trivial program run by cotton-bench. It is linked statically, so that it can
+ * run in boxes that do not have the system libraries. */
+int main() {
+    return 0;
+}
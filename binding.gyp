@@ -0,0 +1,15 @@
+{
+  "targets": [
+    {
+      "target_name": "cotton",
+      "sources": [
+        "nodejs/cotton_addon.cpp",
+        "<!@(ls -1 src/*.cpp | grep -v src/main.cpp)"
+      ],
+      "include_dirs": ["headers"],
+      "cflags_cc": ["-std=c++14", "-fexceptions", "-ftemplate-depth=1024", "-Wno-unused-result"],
+      "cflags_cc!": ["-fno-exceptions", "-fno-rtti", "-std=gnu++1y", "-std=gnu++17"],
+      "libraries": ["-lboost_iostreams", "-lboost_serialization", "-pthread"]
+    }
+  ]
+}
@@ -0,0 +1,41 @@
+#ifndef CGROUP_SANDBOX_HPP
+#define CGROUP_SANDBOX_HPP
+#include "util.hpp"
+#ifdef COTTON_LINUX
+#include "NamespaceSandbox.hpp"
+
+// Runs every command in its own cgroup v2 leaf, which enforces the memory and
+// process limits on the whole box and measures its memory peak and cpu time.
+class CgroupSandbox: public NamespaceSandbox {
+    static std::string cgroup_root();
+    // The parent of the cgroups of the boxes under base_path.
+    std::string root_cgroup_path() const;
+    std::string cgroup_path() const;
+    bool remove_cgroup();
+protected:
+    virtual bool pre_fork_hook() override;
+    virtual bool post_fork_hook() override;
+    virtual bool cleanup_hook() override;
+    virtual void set_limits() override;
+    virtual bool box_checker(pid_t box_pid) override;
+    virtual bool sample_running_time(pid_t box_pid, time_limit_t& used) const override;
+public:
+    using NamespaceSandbox::NamespaceSandbox;
+    virtual feature_mask_t get_features() const override {
+        return NamespaceSandbox::get_features() | Sandbox::process_limit_full;
+    }
+    virtual bool is_available() const override;
+    virtual std::string err_string(int error_id) const override;
+    virtual bool set_process_limit(size_t limit) override {
+        process_limit = limit;
+        return true;
+    }
+    template <typename Archive> void serialize(Archive &ar, const unsigned int version) {
+        ar & boost::serialization::base_object<NamespaceSandbox>(*this);
+    }
+};
+
+DECLARE_SANDBOX(CgroupSandbox);
+
+#endif
+#endif
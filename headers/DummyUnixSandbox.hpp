@@ -3,7 +3,13 @@
 #ifdef COTTON_UNIX
 #include "box.hpp"
 #include "util.hpp"
+#include "file_store.hpp"
+#include "output_checker.hpp"
+#include "perf_counters.hpp"
+#include <chrono>
+#include <memory>
 #include <fcntl.h>
+#include <sys/resource.h>
 #include <sys/stat.h>
 
 class DummyUnixSandbox: public Sandbox {
@@ -23,9 +29,44 @@ protected:
     std::string exit_status;
     size_t return_code = 0;
     size_t signal = 0;
+    int cpu = -1;
+    int run_cpu = -1; // The cpu of the last run
+    bool use_perf_counters = false;
+    uint64_t instruction_limit = 0;
+    uint64_t instruction_count = 0;
+    uint64_t cycle_count = 0;
+    time_limit_t task_clock = 0;
+    space_limit_t output_limit = 0;
+    std::string expected_output;
+    std::string check_mode;
+    double check_tolerance = 0;
+    std::string verdict;
 
     // Transient data
     int comm[2] = {0, 0};
+    std::chrono::steady_clock::time_point fork_time;
+    // Set by fork_box when the child may have started running before the
+    // parent could notice, so that the wall time is counted from fork_time.
+    bool exec_unobserved = false;
+#ifdef COTTON_LINUX
+    PerfCounters perf;
+#endif
+    // A standard stream that is not a file of the box: it is opened by the
+    // parent, and the child gets a copy.
+    struct Stream {
+        int child = -1; // What the child gets, -1 to open the file
+        int pipe = -1;  // With an output limit, the child writes to a pipe
+        int dest = -1;  // and the parent moves the data from it to here.
+        bool owns_dest = false;
+        size_t written = 0;
+    };
+    Stream streams[3];
+    // The output of the last run to the streams redirected to "memfd".
+    int memfds[3] = {-1, -1, -1};
+    // Reads the standard output while the program runs, with an output check.
+    std::unique_ptr<OutputChecker> checker;
+    int cancel_fd = -1;
+    static bool inherit_streams;
 
     static const mode_t box_mode = S_IRWXU | S_IRGRP | S_IROTH;
     static const mode_t file_mode = S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH;
@@ -41,25 +82,110 @@ protected:
     };
 
     virtual size_t create_box(size_t box_limit);
+    // Deleted folders are moved here and removed in the background.
+    std::string trash_path() const {return base_path + "/trash";}
 
     // A negative error_id indicates a warning
     bool send_error(int error_id, int err);
-    // Returns -1 if there was an error, 0 if the pipe is closed and 1 otherwise.
-    int get_error(int& error_id, int& err);
+    // Returns -1 if there was an error, 0 if the socket is closed and 1
+    // otherwise. The file descriptors sent along with the error are stored in
+    // fds, or closed if it is null.
+    int get_error(int& error_id, int& err, std::vector<int>* fds = nullptr);
+    // Sent by the child, with the performance counters, instead of an error.
+    static const int perf_counters_opened = 0;
+    // The messages from this id on are for the subclasses, which get them in
+    // child_message_hook.
+    static const int subclass_message = 1000;
+    // In the child, opens the performance counters and passes them to the
+    // parent, waiting for it when the instruction limit must be watched.
+    bool start_perf_counters();
+    // In the parent, takes the counters sent by the child.
+    // opened has a bit set for every counter in fds.
+    bool attach_perf_counters(int opened, const std::vector<int>& fds);
     virtual std::string err_string(int error_id) const;
 
     bool prepare_io_redirect(const std::string& file, std::string& redir, mode_t mode);
-    bool setup_io_redirect(const std::string& file, int dest_fd, mode_t mode);
+    bool setup_io_redirect(const std::string& file, int stream_fd, int dest_fd, mode_t mode);
+    static bool is_fd_redirect(const std::string& file) {
+        return file == "memfd" || file.compare(0, 3, "fd:") == 0;
+    }
+    // Whether the child gets the stream from the parent instead of opening it.
+    bool gets_stream_from_parent(int stream) const {
+        const std::string* files[3] = {&stdin_, &stdout_, &stderr_};
+        return is_fd_redirect(*files[stream]) || (stream == 1 && !expected_output.empty());
+    }
+    // Fills streams before the fork, and closes them after the run.
+    bool open_streams();
+    void close_streams();
+    // Moves what the child wrote to the pipe of a stream to its destination,
+    // checking it if needed, without blocking. Returns false, with the reason
+    // in kill_reason, if the child must be stopped.
+    bool drain_stream(Stream& stream, std::string& kill_reason);
+    // Opens the folder that contains box_path, creating the missing ones if
+    // create is set, and stores the last component of box_path in name.
+    // Returns -1 if the path is not in the box or cannot be opened.
+    int open_parent(const std::string& box_path, bool create, std::string& name) const;
+    // Imports the file or the folder at orig_path as name in the folder
+    // dir_fd of the box. A symbolic link is imported as a link, unless follow
+    // is set.
+    bool import_into(FileStore& store, const std::string& orig_path, int dir_fd, const std::string& name, bool rw,
+        bool follow);
+    // Writes the file at file.path in the box to fd for export_files, filling
+    // the other fields. file.path is cleared if it is not a regular file.
+    bool export_file(ExportedFile& file, int fd, space_limit_t max_size);
 
+    // The argv of the program, pointing into the command and the arguments.
+    // It is built before the fork: a child forked by a multithreaded process,
+    // such as Node.js, should not allocate.
+    std::vector<char*> exec_args;
+    void prepare_exec_args(const std::string& command, const std::vector<std::string>& args);
+    // Starts the child, which runs child_main, and returns its pid or -1.
+    virtual pid_t fork_box(const std::string& command, const std::vector<std::string>& args);
+    [[noreturn]] void child_main(const std::string& command, const std::vector<std::string>& args);
     [[noreturn]] virtual void box_inner(const std::string& command, const std::vector<std::string>& args);
+    // Sets the resource limits of the child, right before pre_exec_hook.
+    virtual void set_limits();
     virtual bool box_checker(pid_t box_pid);
+    // Runs the command once, with the run lock already held.
+    bool run_locked(const std::string& command, const std::vector<std::string>& args);
+    // Waits for the child to exit, killing it when the wall time or the cpu
+    // time limit expires; in that case kill_reason is set to the exit status.
+    // The resource usage of the child (and of its waited-for descendants) is
+    // stored in usage.
+    bool wait_box(pid_t box_pid, std::chrono::steady_clock::time_point start, int& status,
+        struct rusage& usage, std::string& kill_reason);
+    bool poll_wait_box(pid_t box_pid, std::chrono::steady_clock::time_point start, int& status,
+        struct rusage& usage, std::string& kill_reason);
+    // Measures the cpu time used so far by the running child.
+    virtual bool sample_running_time(pid_t box_pid, time_limit_t& used) const;
+    // Maximum number of cpus the child can keep busy at the same time.
+    virtual size_t cpu_parallelism() const;
+    static const size_t cpu_check_min_interval = 100; // microseconds
     virtual bool pre_fork_hook() {return true;}
     virtual bool post_fork_hook() {return true;}
     virtual bool pre_exec_hook() {return true;}
+    // Runs in the child right before execv, after the privileges are dropped.
+    virtual bool pre_execv_hook() {return true;}
+    // Handles a message of a subclass from the child, taking the descriptors
+    // sent with it. Returns false, with the reason in kill_reason, if the
+    // child must be stopped; the run fails if kill_reason is empty.
+    virtual bool child_message_hook(int message_id, int value, const std::vector<int>& fds,
+        std::string& kill_reason) {
+        for (int fd: fds) close(fd);
+        return true;
+    }
+    // A descriptor of a subclass that wait_box watches, -1 for none. When it
+    // is readable watched_fd_hook is called, and the child is killed if it
+    // returns false with the reason in kill_reason.
+    virtual int watched_fd() const {return -1;}
+    virtual bool watched_fd_hook(std::string& kill_reason) {return true;}
     virtual bool cleanup_hook() {return true;}
     DummyUnixSandbox() {}
 public:
     DummyUnixSandbox(const std::string& base_path): Sandbox(base_path) {}
+    // Whether the children get the standard streams of this process when they
+    // are not redirected, or /dev/null.
+    static void set_inherit_streams(bool inherit) {inherit_streams = inherit;}
     virtual bool is_available() const override {
         return true; // If it compiles, it should work.
     }
@@ -70,7 +196,12 @@ public:
         return Sandbox::memory_limit | Sandbox::cpu_limit | Sandbox::wall_time_limit |
             Sandbox::process_limit | Sandbox::disk_limit | Sandbox::memory_usage |
             Sandbox::running_time | Sandbox::wall_time | Sandbox::io_redirection |
-            Sandbox::return_code | Sandbox::signal;
+            Sandbox::return_code | Sandbox::signal | Sandbox::clearable | Sandbox::fd_redirection |
+            Sandbox::output_check | Sandbox::cancellable | Sandbox::file_import | Sandbox::file_export
+#ifdef COTTON_LINUX
+            | Sandbox::cpu_affinity | (PerfCounters::is_available() ? Sandbox::perf_counters : 0)
+#endif
+            ;
     }
     virtual size_t create_box() override {
         return create_box(std::numeric_limits<int>::max());
@@ -99,6 +230,18 @@ public:
         disk_limit = limit;
         return true;
     }
+    virtual bool set_cpu(int cpu) override;
+    virtual int get_cpu() const override {
+        return cpu;
+    }
+    virtual bool set_perf_counters(bool enabled) override;
+    virtual bool get_perf_counters() const override {
+        return use_perf_counters;
+    }
+    virtual bool set_instruction_limit(uint64_t limit) override;
+    virtual uint64_t get_instruction_limit() const override {
+        return instruction_limit;
+    }
     virtual space_limit_t get_memory_limit() const override {
         return mem_limit;
     }
@@ -114,6 +257,10 @@ public:
     virtual space_limit_t get_disk_limit() const override {
         return disk_limit;
     }
+    virtual bool set_cancel_fd(int fd) override {
+        cancel_fd = fd;
+        return true;
+    }
     virtual bool redirect_stdin(const std::string& stdin_file) override {
         return prepare_io_redirect(stdin_file, stdin_, O_RDONLY);
     }
@@ -132,7 +279,24 @@ public:
     virtual std::string get_stderr() const override {
         return stderr_;
     }
+    virtual bool set_output_limit(space_limit_t limit) override {
+        output_limit = limit;
+        return true;
+    }
+    virtual space_limit_t get_output_limit() const override {
+        return output_limit;
+    }
+    virtual int get_output_fd(const std::string& stream) const override;
+    virtual bool set_output_check(const std::string& expected_path, const std::string& mode, double tolerance) override;
+    virtual std::string get_output_check() const override {
+        return expected_output;
+    }
+    virtual bool import_file(const std::string& box_path, const std::string& orig_path, bool rw = false) override;
+    virtual std::vector<ExportedFile> export_files(const std::vector<std::string>& patterns, int fd,
+        space_limit_t max_size = 0) override;
     virtual bool run(const std::string& command, const std::vector<std::string>& args) override;
+    virtual std::vector<RunResult> run_many(const std::string& command, const std::vector<std::string>& args,
+        const std::vector<std::pair<std::string, std::string>>& cases) override;
     virtual space_limit_t get_memory_usage() const override {
         return memory_usage;
     }
@@ -151,6 +315,8 @@ public:
     virtual std::string get_status() const override {
         return exit_status;
     }
+    virtual RunResult get_run_result() const override;
+    virtual bool clear() override;
     virtual bool delete_box() override;
     friend class boost::serialization::access;
     template <typename Archive> void serialize(Archive &ar, const unsigned int version) {
@@ -169,15 +335,35 @@ public:
         ar & exit_status;
         ar & return_code;
         ar & signal;
+        if (version >= 1) {
+            ar & cpu;
+            ar & run_cpu;
+        }
+        if (version >= 2) {
+            ar & use_perf_counters;
+            ar & instruction_limit;
+            ar & instruction_count;
+            ar & cycle_count;
+            ar & task_clock;
+        }
+        if (version >= 3) ar & output_limit;
+        if (version >= 4) {
+            ar & expected_output;
+            ar & check_mode;
+            ar & check_tolerance;
+            ar & verdict;
+        }
     };
-    virtual ~DummyUnixSandbox() = default;
+    virtual ~DummyUnixSandbox();
     //virtual bool check();
     //virtual std::vector<std::pair<std::string, std::string>> mount()
     //virtual std::string mount(const std::string& box_path)
     //virtual bool mount(const std::string& box_path, const std::string& orig_path, bool rw = false)
     //virtual bool umount(const std::string& box_path)
-    //virtual bool clear()
 };
 
+DECLARE_SANDBOX(DummyUnixSandbox);
+BOOST_CLASS_VERSION(DummyUnixSandbox, 4);
+
 #endif
 #endif
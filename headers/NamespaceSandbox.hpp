@@ -7,26 +7,80 @@
 
 class NamespaceSandbox: public DummyUnixSandbox {
     std::map<std::string, std::pair<std::string, bool>> mountpoints;
-    virtual bool pre_fork_hook();
+    std::string root_fs = "dir";
+    std::string root_lower;
+    // The mounts of the persistent mount namespace, as given by zygote_key,
+    // empty if there is none.
+    std::string mount_ns_key;
+    std::string overlay_path() const {return box_base_path(base_path, id_) + "overlay/";}
+    // The mount namespace with every mountpoint is kept alive by a bind mount
+    // of its file in this folder, so that the runs only need to enter it.
+    std::string mount_ns_path() const {return box_base_path(base_path, id_) + "mount_ns/";}
+    std::string tmpfs_options(mode_t mode) const;
+    // Mounts the root filesystem on the host, so that it survives between runs.
+    bool mount_root();
+    bool umount_root();
+    bool create_mountpoints();
+
+    // Transient data
+    bool in_zygote = false; // The namespaces and the mounts are already set up
+    int mount_ns_fd = -1;   // The persistent mount namespace, while running
+    bool use_zygote = false; // Even if the zygotes are not enabled, for run_many
+
+    // In the parent, opens the persistent mount namespace, creating it again
+    // if the mountpoints changed.
+    bool open_mount_namespace();
+    bool create_mount_namespace();
+    void drop_mount_namespace();
+
+    bool enter_namespaces();
+    bool mount_all();
+    // Describes everything the zygote sets up, so that it is restarted when
+    // any of it changes.
+    std::string zygote_key() const;
+    void stop_zygote();
+    [[noreturn]] static void zygote_child(const std::string& request, const std::vector<int>& fds);
+protected:
+    virtual pid_t fork_box(const std::string& command, const std::vector<std::string>& args) override;
+    virtual bool pre_fork_hook() override;
     virtual bool post_fork_hook();
     virtual bool pre_exec_hook();
-    virtual bool cleanup_hook();
+    virtual bool cleanup_hook() override;
+    virtual void set_limits() override;
 public:
     using DummyUnixSandbox::DummyUnixSandbox;
     virtual feature_mask_t get_features() const override {
         return DummyUnixSandbox::get_features() | Sandbox::process_isolation |
-            Sandbox::network_isolation | Sandbox::folder_mount;
+            Sandbox::network_isolation | Sandbox::folder_mount |
+            Sandbox::disk_limit_full; // With a tmpfs or overlay root
     }
     virtual bool is_available() const override;
     virtual std::string err_string(int error_id) const override;
     template <typename Archive> void serialize(Archive &ar, const unsigned int version) {
         ar & boost::serialization::base_object<DummyUnixSandbox>(*this);
         ar & mountpoints;
+        if (version >= 1) {
+            ar & root_fs;
+            ar & root_lower;
+        }
+        if (version >= 2) ar & mount_ns_key;
     }
     virtual std::string mount(const std::string& box_path) const override;
     virtual bool mount(const std::string& box_path, const std::string& orig_path, bool rw = false) override;
     virtual bool umount(const std::string& box_path) override;
+    virtual bool set_disk_limit(space_limit_t limit) override;
+    virtual bool set_root_fs(const std::string& type, const std::string& lower_path = "") override;
+    virtual std::string get_root_fs() const override {
+        return root_fs;
+    }
+    virtual std::vector<RunResult> run_many(const std::string& command, const std::vector<std::string>& args,
+        const std::vector<std::pair<std::string, std::string>>& cases) override;
+    virtual bool clear() override;
+    virtual bool delete_box() override;
 };
 
+DECLARE_SANDBOX(NamespaceSandbox);
+BOOST_CLASS_VERSION(NamespaceSandbox, 2);
+
 #endif
 #endif
@@ -0,0 +1,58 @@
+#ifndef SECCOMP_SANDBOX_HPP
+#define SECCOMP_SANDBOX_HPP
+#include "util.hpp"
+#ifdef COTTON_LINUX
+#include "NamespaceSandbox.hpp"
+#include <linux/filter.h>
+
+// Allows only the syscalls of a profile to the program, with a seccomp filter
+// installed right before the exec. The other syscalls are sent to the parent
+// through a seccomp listener, so that it knows which one was attempted, and
+// the parent kills the program. The filters are compiled once per process.
+class SeccompSandbox: public NamespaceSandbox {
+    std::string syscall_profile;
+
+    // Transient data
+    int listener = -1; // Gets the syscalls that the profile does not allow
+
+    // Sent by the child with the listener.
+    static const int listener_opened = subclass_message;
+    // The filter of a profile, or nullptr if the profile does not exist. The
+    // child sets in it the descriptor it sends the listener on.
+    static std::vector<struct sock_filter>* compiled_filter(const std::string& profile);
+    static bool allows_exec(const std::string& profile);
+    // Waits for the next syscall sent to the listener. If it is an exec and
+    // allow_exec is set, the syscall is let through; otherwise returns false
+    // with the syscall in kill_reason.
+    bool check_syscall(bool allow_exec, std::string& kill_reason);
+protected:
+    virtual bool pre_fork_hook() override;
+    virtual bool pre_execv_hook() override;
+    virtual bool child_message_hook(int message_id, int value, const std::vector<int>& fds,
+        std::string& kill_reason) override;
+    virtual int watched_fd() const override {return listener;}
+    virtual bool watched_fd_hook(std::string& kill_reason) override {
+        return check_syscall(false, kill_reason);
+    }
+    virtual bool cleanup_hook() override;
+public:
+    using NamespaceSandbox::NamespaceSandbox;
+    virtual feature_mask_t get_features() const override {
+        return NamespaceSandbox::get_features() | Sandbox::syscall_filter;
+    }
+    virtual bool is_available() const override;
+    virtual std::string err_string(int error_id) const override;
+    virtual bool set_syscall_profile(const std::string& profile) override;
+    virtual std::string get_syscall_profile() const override {
+        return syscall_profile;
+    }
+    template <typename Archive> void serialize(Archive &ar, const unsigned int version) {
+        ar & boost::serialization::base_object<NamespaceSandbox>(*this);
+        ar & syscall_profile;
+    }
+};
+
+DECLARE_SANDBOX(SeccompSandbox);
+
+#endif
+#endif
@@ -5,17 +5,31 @@
 #include <cstdint>
 #include "logger.hpp"
 #include "util.hpp"
+#include "box_archive.hpp"
+#include "run_result.hpp"
 
 #include <boost/serialization/export.hpp>
 #include <boost/archive/text_oarchive.hpp>
 #include <boost/archive/text_iarchive.hpp>
+// To be used in the header of every sandbox, after the class definition, so that
+// all translation units agree on the name used to serialize it.
+#define DECLARE_SANDBOX(sbx) BOOST_CLASS_EXPORT_KEY(sbx)
 #define REGISTER_SANDBOX(sbx) __attribute__((constructor)) static void register_sandbox_ ## sbx() { \
     if (box_creators == nullptr) { \
         box_creators = new BoxCreators(); \
     } \
     (*box_creators)[#sbx] = &create_sandbox<sbx>; \
+    if (box_serializers == nullptr) { \
+        box_serializers = new BoxSerializers(); \
+        box_type_names = new BoxTypeNames(); \
+    } \
+    (*box_serializers)[#sbx] = { \
+        [] (BoxWriter& ar, Sandbox& s) {ar & static_cast<sbx&>(s);}, \
+        [] (BoxReader& ar, Sandbox& s) {ar & static_cast<sbx&>(s);} \
+    }; \
+    (*box_type_names)[typeid(sbx)] = #sbx; \
 } \
-BOOST_CLASS_EXPORT(sbx)
+BOOST_CLASS_EXPORT_IMPLEMENT(sbx)
 
 class Sandbox {
 protected:
@@ -46,6 +60,14 @@ public:
     static const feature_mask_t network_isolation    = 0x00004000;
     static const feature_mask_t return_code          = 0x00008000;
     static const feature_mask_t signal               = 0x00010000;
+    static const feature_mask_t cpu_affinity         = 0x00020000; // Pins the box to a cpu
+    static const feature_mask_t perf_counters        = 0x00040000; // Counts instructions and cycles
+    static const feature_mask_t fd_redirection       = 0x00080000; // Redirects to descriptors and memfds
+    static const feature_mask_t output_check         = 0x00100000; // Checks the output while it is written
+    static const feature_mask_t cancellable          = 0x00200000; // Runs can be stopped by another process
+    static const feature_mask_t syscall_filter       = 0x00400000; // Allows only the syscalls of a profile
+    static const feature_mask_t file_import          = 0x00800000; // Shares imported files between boxes
+    static const feature_mask_t file_export          = 0x01000000; // Streams files out of the box
     friend class boost::serialization::access;
 
     void set_error_handler(const callback_t& cb) {on_error = &cb;}
@@ -85,6 +107,35 @@ public:
         error(254, "This method is not implemented by this sandbox!");
         return false;
     }
+    // Pins the next runs to a cpu, or lets them run anywhere if cpu is -1.
+    virtual bool set_cpu(int cpu) {
+        error(254, "This method is not implemented by this sandbox!");
+        return false;
+    }
+    virtual int get_cpu() const {
+        error(254, "This method is not implemented by this sandbox!");
+        return -1;
+    }
+    // Counts the instructions, the cycles and the cpu time of the next runs
+    // with the hardware performance counters.
+    virtual bool set_perf_counters(bool enabled) {
+        error(254, "This method is not implemented by this sandbox!");
+        return false;
+    }
+    virtual bool get_perf_counters() const {
+        error(254, "This method is not implemented by this sandbox!");
+        return false;
+    }
+    // Kills the program after this many instructions, 0 for no limit. Setting
+    // a limit also enables the performance counters.
+    virtual bool set_instruction_limit(uint64_t limit) {
+        error(254, "This method is not implemented by this sandbox!");
+        return false;
+    }
+    virtual uint64_t get_instruction_limit() const {
+        error(254, "This method is not implemented by this sandbox!");
+        return 0;
+    }
     virtual space_limit_t get_memory_limit() const {
         error(254, "This method is not implemented by this sandbox!");
         return 0;
@@ -121,6 +172,17 @@ public:
         error(254, "This method is not implemented by this sandbox!");
         return false;
     }
+    // Puts the file or the folder at orig_path in the box at box_path. The
+    // files are kept once for all the boxes in a content-addressed store, and
+    // unless rw is set they are read-only, and may be links to the store. The
+    // symbolic links inside a folder are imported as links.
+    virtual bool import_file(const std::string& box_path, const std::string& orig_path, bool rw = false) {
+        error(254, "This method is not implemented by this sandbox!");
+        return false;
+    }
+    // The redirections take a path in the box, or with fd_redirection
+    // "fd:N" for the file descriptor N of the process that runs the box, and
+    // "memfd" for an output kept in memory, see get_output_fd.
     virtual bool redirect_stdin(const std::string& stdin_file) {
         error(254, "This method is not implemented by this sandbox!");
         return false;
@@ -145,7 +207,71 @@ public:
         error(254, "This method is not implemented by this sandbox!");
         return "";
     }
+    // Kills the program when it writes more than this to a stream redirected
+    // to a file descriptor or to a memfd, 0 for no limit.
+    virtual bool set_output_limit(space_limit_t limit) {
+        error(254, "This method is not implemented by this sandbox!");
+        return false;
+    }
+    virtual space_limit_t get_output_limit() const {
+        error(254, "This method is not implemented by this sandbox!");
+        return 0;
+    }
+    // The memfd holding what the last run wrote to a stream redirected to
+    // "memfd", or -1. It belongs to the box, and is replaced at every run.
+    virtual int get_output_fd(const std::string& stream) const {
+        error(254, "This method is not implemented by this sandbox!");
+        return -1;
+    }
+    // Compares the standard output of the next runs with the file at
+    // expected_path while they are running, stopping them at the first
+    // difference. mode is "exact", "tokens" or "floats", which compares
+    // numbers with an absolute or relative tolerance. An empty path disables
+    // the check.
+    virtual bool set_output_check(const std::string& expected_path, const std::string& mode, double tolerance) {
+        error(254, "This method is not implemented by this sandbox!");
+        return false;
+    }
+    virtual std::string get_output_check() const {
+        error(254, "This method is not implemented by this sandbox!");
+        return "";
+    }
+    // Allows only the syscalls of a profile to the next runs, "" for all of
+    // them. The program is killed at the first other syscall, with the status
+    // "Forbidden syscall N".
+    virtual bool set_syscall_profile(const std::string& profile) {
+        error(254, "This method is not implemented by this sandbox!");
+        return false;
+    }
+    virtual std::string get_syscall_profile() const {
+        error(254, "This method is not implemented by this sandbox!");
+        return "";
+    }
+    // Kills the program of the next runs, with the status "Cancelled", as soon
+    // as fd is readable. -1 for none. It is not saved with the box.
+    virtual bool set_cancel_fd(int fd) {
+        error(254, "This method is not implemented by this sandbox!");
+        return false;
+    }
+    // Writes the regular files of the box that match one of the patterns,
+    // which can have the wildcards of glob, to fd. Each file comes after a
+    // line with the number of bytes that follow, 1 if the file was cut at
+    // max_size (0 for no cap) or else 0, and its path in the box. Returns the
+    // files written, in this order.
+    virtual std::vector<ExportedFile> export_files(const std::vector<std::string>& patterns, int fd,
+        space_limit_t max_size = 0) {
+        error(254, "This method is not implemented by this sandbox!");
+        return {};
+    }
     virtual bool run(const std::string& command, const std::vector<std::string>& args) = 0;
+    // Runs the command once for every (stdin, stdout) pair, with the same
+    // limits, and returns the result of each run. Runs that could not be
+    // started have success set to false.
+    virtual std::vector<RunResult> run_many(const std::string& command, const std::vector<std::string>& args,
+        const std::vector<std::pair<std::string, std::string>>& cases) {
+        error(254, "This method is not implemented by this sandbox!");
+        return {};
+    }
     virtual space_limit_t get_memory_usage() const {
         error(254, "This method is not implemented by this sandbox!");
         return 0;
@@ -166,10 +292,32 @@ public:
         error(254, "This method is not implemented by this sandbox!");
         return 0;
     }
+    // All the statistics of the last run. Those that the sandbox does not
+    // support are left to zero.
+    virtual RunResult get_run_result() const {
+        RunResult res;
+        feature_mask_t features = get_features();
+        if (features & return_code) res.return_code = get_return_code();
+        if (features & signal) res.signal = get_signal();
+        if (features & running_time) res.running_time = get_running_time();
+        if (features & wall_time) res.wall_time = get_wall_time();
+        if (features & memory_usage) res.memory_usage = get_memory_usage();
+        return res;
+    }
     virtual bool clear() {
         error(254, "This method is not implemented by this sandbox!");
         return false;
     }
+    // The filesystem that backs the root of the box: "dir" for a plain folder,
+    // "tmpfs" for a tmpfs, "overlay" for an overlay of lower_path with a tmpfs.
+    virtual bool set_root_fs(const std::string& type, const std::string& lower_path = "") {
+        error(254, "This method is not implemented by this sandbox!");
+        return false;
+    }
+    virtual std::string get_root_fs() const {
+        error(254, "This method is not implemented by this sandbox!");
+        return "";
+    }
     virtual std::string get_status() const {
         error(254, "This method is not implemented by this sandbox!");
         return "";
@@ -0,0 +1,152 @@
+#ifndef COTTON_BOX_ARCHIVE_HPP
+#define COTTON_BOX_ARCHIVE_HPP
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <typeindex>
+#include <vector>
+#include <boost/serialization/access.hpp>
+#include <boost/serialization/version.hpp>
+
+class Sandbox;
+
+// Binary archives for the state of the boxes. They work with the same
+// serialize methods as the boost archives, but they write the fields as they
+// are in memory, prefixing every class with its version, and they find the
+// type of a box by its name instead of going through the boost class export
+// machinery. The data is only meant to be read on the machine that wrote it.
+class BoxWriter {
+    std::string data_;
+    template <typename T> void save(const T& t, std::true_type) {
+        data_.append((const char*)&t, sizeof t);
+    }
+    template <typename T> void save(const T& t, std::false_type) {
+        uint32_t version = boost::serialization::version<T>::value;
+        *this & version;
+        boost::serialization::access::serialize(*this, const_cast<T&>(t), version);
+    }
+public:
+    template <typename T> BoxWriter& operator&(const T& t) {
+        save(t, std::integral_constant<bool, std::is_arithmetic<T>::value || std::is_enum<T>::value>());
+        return *this;
+    }
+    BoxWriter& operator&(const std::string& s) {
+        uint64_t size = s.size();
+        *this & size;
+        data_ += s;
+        return *this;
+    }
+    template <typename A, typename B> BoxWriter& operator&(const std::pair<A, B>& p) {
+        return *this & p.first & p.second;
+    }
+    template <typename K, typename V> BoxWriter& operator&(const std::map<K, V>& m) {
+        uint64_t size = m.size();
+        *this & size;
+        for (const auto& kv: m) *this & kv.first & kv.second;
+        return *this;
+    }
+    template <typename T> BoxWriter& operator&(const std::vector<T>& v) {
+        uint64_t size = v.size();
+        *this & size;
+        for (const auto& item: v) *this & item;
+        return *this;
+    }
+    template <typename T> BoxWriter& operator<<(const T& t) {return *this & t;}
+    // Writes the name of the type of the box, followed by the box itself.
+    void save_box(const Sandbox& box);
+    const std::string& data() const {return data_;}
+};
+
+// Reads the data written by a BoxWriter, throwing std::runtime_error if it is
+// truncated or otherwise invalid.
+class BoxReader {
+    const char* pos_;
+    const char* end_;
+    void need(size_t len) {
+        if ((size_t)(end_ - pos_) < len) throw std::runtime_error("Truncated box state");
+    }
+    template <typename T> void load(T& t, std::true_type) {
+        need(sizeof t);
+        memcpy(&t, pos_, sizeof t);
+        pos_ += sizeof t;
+    }
+    template <typename T> void load(T& t, std::false_type) {
+        uint32_t version;
+        *this & version;
+        if (version > boost::serialization::version<T>::value)
+            throw std::runtime_error("Box state written by a newer version");
+        boost::serialization::access::serialize(*this, t, version);
+    }
+public:
+    BoxReader(const char* data, size_t len): pos_(data), end_(data + len) {}
+    template <typename T> BoxReader& operator&(T& t) {
+        load(t, std::integral_constant<bool, std::is_arithmetic<T>::value || std::is_enum<T>::value>());
+        return *this;
+    }
+    BoxReader& operator&(std::string& s) {
+        uint64_t size;
+        *this & size;
+        need(size);
+        s.assign(pos_, size);
+        pos_ += size;
+        return *this;
+    }
+    template <typename A, typename B> BoxReader& operator&(std::pair<A, B>& p) {
+        return *this & p.first & p.second;
+    }
+    template <typename K, typename V> BoxReader& operator&(std::map<K, V>& m) {
+        uint64_t size;
+        *this & size;
+        m.clear();
+        for (uint64_t i=0; i<size; i++) {
+            std::pair<K, V> kv;
+            *this & kv.first & kv.second;
+            m.insert(std::move(kv));
+        }
+        return *this;
+    }
+    template <typename T> BoxReader& operator&(std::vector<T>& v) {
+        uint64_t size;
+        *this & size;
+        need(size);
+        v.resize(size);
+        for (auto& item: v) *this & item;
+        return *this;
+    }
+    template <typename T> BoxReader& operator>>(T& t) {return *this & t;}
+    // Reads a box written by BoxWriter::save_box. The caller owns the result.
+    Sandbox* load_box();
+};
+
+struct BoxSerializer {
+    std::function<void(BoxWriter&, Sandbox&)> save;
+    std::function<void(BoxReader&, Sandbox&)> load;
+};
+typedef std::map<std::string, BoxSerializer> BoxSerializers;
+typedef std::map<std::type_index, std::string> BoxTypeNames;
+// Filled by REGISTER_SANDBOX.
+extern BoxSerializers* box_serializers;
+extern BoxTypeNames* box_type_names;
+
+// The boxinfo file starts with a fixed header: the magic string, the format
+// version, and the size of the rest of the file.
+struct BoxInfoHeader {
+    static constexpr const char* magic_value = "COTTONBX";
+    static const uint32_t current_version = 1;
+    char magic[8];
+    uint32_t version;
+    uint32_t reserved;
+    uint64_t size;
+};
+
+// Reads a boxinfo file, in the binary or in the old text format.
+Sandbox* read_box_info(const std::string& path);
+// Atomically replaces a boxinfo file, writing it in the binary format. Unless
+// sync is false, the file is flushed to disk before it replaces the old one.
+void write_box_info(const std::string& path, const Sandbox& box, bool sync = true);
+
+#endif
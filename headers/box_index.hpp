@@ -0,0 +1,52 @@
+#ifndef COTTON_BOX_INDEX_HPP
+#define COTTON_BOX_INDEX_HPP
+#include "util.hpp"
+#ifdef COTTON_UNIX
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Bitmap of the box ids in use under a base path, stored in its box_index
+// file after a header. Every instance holds an exclusive lock on the file, so
+// that concurrent cotton processes never hand out the same id.
+class BoxIndex {
+    struct Header {
+        uint64_t magic;
+        uint64_t free_hint; // No word before this one has a free id
+        uint64_t reap_at;   // Size of the bitmap, in words, for the next reap
+    };
+    static const uint64_t magic_value = 0x3178656469786f62ULL; // "boxidex1"
+    std::string base_path;
+    int fd = -1;
+    Header header = {};
+    std::vector<uint64_t> bitmap;
+    void set(size_t id, bool used);
+    void write_header();
+    void rebuild();
+public:
+    BoxIndex(const std::string& base_path);
+    BoxIndex(const BoxIndex&) = delete;
+    BoxIndex& operator=(const BoxIndex&) = delete;
+    // Returns false and sets errno if the index could not be opened and locked.
+    bool is_open() const {return fd != -1;}
+    // Returns the smallest free id below box_limit, marking it as used, or 0.
+    // The leaked ids are reaped only when none is free, and then only once
+    // the bitmap doubled since the last time, or if it cannot grow anymore.
+    size_t allocate(size_t box_limit);
+    void mark(size_t id) {set(id, true);}
+    void release(size_t id) {set(id, false);}
+    // Releases the ids whose box disappeared, or whose creator died before
+    // finishing to set it up.
+    void reap();
+    // Atomically creates a lock file owned by this process, failing with EEXIST
+    // if it already exists.
+    static bool create_lock(const std::string& lock_file, mode_t mode);
+    // Returns the pid that owns a lock file, or 0 if it is unknown.
+    static pid_t lock_owner(const std::string& lock_file);
+    // Checks whether the owner of a lock file is known to be dead.
+    static bool is_stale_lock(const std::string& lock_file);
+    ~BoxIndex();
+};
+
+#endif
+#endif
@@ -0,0 +1,109 @@
+#ifndef COTTON_COMMANDS_HPP
+#define COTTON_COMMANDS_HPP
+#include <memory>
+#include <string>
+#include <vector>
+#include "box.hpp"
+#include "simple_json.hpp"
+
+// When the box cache is enabled, loaded boxes are kept in memory and are only
+// read again from disk if their boxinfo file was changed by someone else.
+void set_box_cache(bool enabled);
+// Pins the programs run by the following commands to a cpu, -1 to let them
+// run anywhere.
+void set_run_cpu(int cpu);
+// File descriptors received with the current request: they replace the
+// descriptors of this process in the "fd:N" redirections, N being the index.
+void set_passed_fds(const std::vector<int>& fds);
+std::shared_ptr<Sandbox> load_box(const std::string& box_root, const std::string& box_id);
+void save_box(const std::string& box_root, const std::shared_ptr<Sandbox>& s);
+
+// Implementation of the cotton commands, shared between the command line
+// interface and the serve mode. Results and errors go to the global logger.
+namespace commands {
+void list(const std::string& box_root);
+void create(const std::string& box_root, const std::string& box_type);
+void check(const std::string& box_root, const std::string& box_id);
+void get_root(const std::string& box_root, const std::string& box_id);
+void cpu_limit(const std::string& box_root, const std::string& box_id);
+void cpu_limit(const std::string& box_root, const std::string& box_id, time_limit_t value);
+void wall_limit(const std::string& box_root, const std::string& box_id);
+void wall_limit(const std::string& box_root, const std::string& box_id, time_limit_t value);
+void memory_limit(const std::string& box_root, const std::string& box_id);
+void memory_limit(const std::string& box_root, const std::string& box_id, space_limit_t value);
+void disk_limit(const std::string& box_root, const std::string& box_id);
+void disk_limit(const std::string& box_root, const std::string& box_id, space_limit_t value);
+void process_limit(const std::string& box_root, const std::string& box_id);
+void process_limit(const std::string& box_root, const std::string& box_id, int value);
+void perf_counters(const std::string& box_root, const std::string& box_id);
+void perf_counters(const std::string& box_root, const std::string& box_id, bool value);
+void instruction_limit(const std::string& box_root, const std::string& box_id);
+void instruction_limit(const std::string& box_root, const std::string& box_id, uint64_t value);
+void output_limit(const std::string& box_root, const std::string& box_id);
+void output_limit(const std::string& box_root, const std::string& box_id, space_limit_t value);
+void output_check(const std::string& box_root, const std::string& box_id);
+void syscall_profile(const std::string& box_root, const std::string& box_id);
+void syscall_profile(const std::string& box_root, const std::string& box_id, const std::string& profile);
+void output_check(const std::string& box_root, const std::string& box_id, const std::string& expected_path,
+    const std::string& mode, double tolerance);
+// Writes the files of the box that match the patterns to dest, "fd:N" or the
+// path of a unix socket, each one cut after max_size if it is not 0.
+void export_files(const std::string& box_root, const std::string& box_id, const std::vector<std::string>& patterns,
+    const std::string& dest, space_limit_t max_size);
+// Writes what the last run wrote to a stream redirected to "memfd".
+void output(const std::string& box_root, const std::string& box_id, const std::string& stream);
+void redirect(const std::string& box_root, const std::string& box_id, const std::string& stream);
+void redirect(const std::string& box_root, const std::string& box_id, const std::string& stream, std::string value);
+void root_fs(const std::string& box_root, const std::string& box_id);
+void root_fs(const std::string& box_root, const std::string& box_id, const std::string& type,
+    const std::string& lower_path);
+void mount(const std::string& box_root, const std::string& box_id, const std::string& inner_path);
+void mount(const std::string& box_root, const std::string& box_id, const std::string& inner_path,
+    const std::string& outer_path, bool rw);
+void umount(const std::string& box_root, const std::string& box_id, const std::string& inner_path);
+void import(const std::string& box_root, const std::string& box_id, const std::string& inner_path,
+    const std::string& outer_path, bool rw);
+void run(const std::string& box_root, const std::string& box_id, const std::string& exec,
+    const std::vector<std::string>& args);
+// Runs exec once for every (stdin, stdout) pair.
+void run_many(const std::string& box_root, const std::string& box_id, const std::string& exec,
+    const std::vector<std::string>& args, const std::vector<std::pair<std::string, std::string>>& cases);
+// Runs exec in a box and manager_exec in another one at the same time, with
+// the stdout of each one connected to the stdin of the other. Both programs
+// are killed as soon as one of them fails, or exits with a non-zero code. The
+// results
+// are those of the program and of the manager, in this order.
+void run_interactive(const std::string& box_root, const std::string& box_id, const std::string& exec,
+    const std::vector<std::string>& args, const std::string& manager_id, const std::string& manager_exec,
+    const std::vector<std::string>& manager_args);
+void running_time(const std::string& box_root, const std::string& box_id);
+void wall_time(const std::string& box_root, const std::string& box_id);
+void memory_usage(const std::string& box_root, const std::string& box_id);
+void status(const std::string& box_root, const std::string& box_id);
+void return_code(const std::string& box_root, const std::string& box_id);
+void signal(const std::string& box_root, const std::string& box_id);
+void run_result(const std::string& box_root, const std::string& box_id);
+void clear(const std::string& box_root, const std::string& box_id);
+void destroy(const std::string& box_root, const std::string& box_id);
+
+// Executes a command given as a JSON object. The "cmd" field holds the command
+// name as on the command line, "box" the box id and the remaining fields the
+// command arguments, named after the command line options, e.g.
+//   {"cmd": "create", "box_type": "NamespaceSandbox"}
+//   {"cmd": "memory-limit", "box": 3, "value": 65536}
+//   {"cmd": "perf-counters", "box": 3, "value": true}
+//   {"cmd": "redirect", "box": 3, "stream": "stdin", "value": "input.txt"}
+//   {"cmd": "root-fs", "box": 3, "value": "overlay", "external_path": "/srv/base"}
+//   {"cmd": "mount", "box": 3, "internal_path": "/usr", "external_path": "/usr", "rw": false}
+//   {"cmd": "import", "box": 3, "internal_path": "tests", "external_path": "/srv/tests"}
+//   {"cmd": "export", "box": 3, "files": ["output.txt", "logs/*"], "to": "fd:0", "max_size": 1024}
+//   {"cmd": "run", "box": 3, "exec": "sol", "args": ["--fast"]}
+//   {"cmd": "run-many", "box": 3, "exec": "sol", "cases": [["in1", "out1"], ["in2", "out2"]]}
+//   {"cmd": "run-interactive", "box": 3, "exec": "sol", "manager_box": 4, "manager_exec": "manager"}
+// Any command can also have "timings": true, to get the duration of its
+// phases in the reply, and "trace" with the path of a Chrome trace to write.
+// Throws std::runtime_error if the command is malformed.
+void execute(const std::string& box_root, const json_value& cmd);
+}
+
+#endif
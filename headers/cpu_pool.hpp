@@ -0,0 +1,24 @@
+#ifndef COTTON_CPU_POOL_HPP
+#define COTTON_CPU_POOL_HPP
+#include "util.hpp"
+#ifdef COTTON_LINUX
+#include <vector>
+
+// The cpus that boxes can be pinned to: one for every physical core that this
+// process is allowed to run on, so that two boxes never share a core through
+// SMT. Every cpu is given to a single box at a time.
+class CpuPool {
+    std::vector<int> free_cpus;
+    size_t size_ = 0;
+public:
+    CpuPool();
+    // Number of cpus in the pool, free or not.
+    size_t size() const {return size_;}
+    bool has_free() const {return !free_cpus.empty();}
+    // Returns a free cpu, or -1 if there is none.
+    int acquire();
+    void release(int cpu);
+};
+
+#endif
+#endif
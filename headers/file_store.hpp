@@ -0,0 +1,34 @@
+#ifndef COTTON_FILE_STORE_HPP
+#define COTTON_FILE_STORE_HPP
+#include "util.hpp"
+#ifdef COTTON_UNIX
+#include <string>
+
+// Content-addressed store of the files imported into the boxes under a base
+// path. Every content is kept once, read-only, in a file named after its
+// SHA-1, which the boxes get as a hardlink when they cannot write to it, or
+// else as a reflink or a copy. The source files are remembered by device,
+// inode, size and times, so that each one is hashed only once.
+class FileStore {
+    std::string path;
+    std::string objects_path() const {return path + "objects/";}
+    std::string inodes_path() const {return path + "inodes/";}
+    std::string tmp_path() const {return path + "tmp/";}
+public:
+    FileStore(const std::string& base_path): path(base_path + "/store/") {}
+    // Adds the regular file at source to the store, and returns the path of
+    // the stored file, or "" setting errno. The executable files are kept
+    // apart from the others with the same content.
+    std::string add(const std::string& source);
+    // Creates name in the folder dir_fd with the content of a stored file,
+    // which must not exist yet. A hardlink is used only if the programs in
+    // the boxes cannot modify the stored file, and writable is false.
+    // Returns false and sets errno on failure.
+    static bool place(const std::string& stored, int dir_fd, const std::string& name, bool writable);
+    // Copies size bytes from the start of from into the empty file to,
+    // sharing the blocks if the filesystem allows it.
+    static bool copy_data(int from, int to, size_t size);
+};
+
+#endif
+#endif
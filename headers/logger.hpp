@@ -3,6 +3,8 @@
 #include <tuple>
 #include <vector>
 #include <functional>
+#include <iostream>
+#include "run_result.hpp"
 #include "simple_json.hpp"
 #include "util.hpp"
 typedef std::function<void(int, const std::string& str)> callback_t;
@@ -28,6 +30,11 @@ public:
     virtual void result(const space_limit_t& space) = 0;
     virtual void result(const std::vector<std::pair<std::string, std::string>>& res) = 0;
     virtual void result(const std::vector<std::tuple<std::string, int, std::vector<std::string>>>& res) = 0;
+    virtual void result(const RunResult& res) = 0;
+    virtual void result(const std::vector<RunResult>& res) = 0;
+    virtual void result(const std::vector<ExportedFile>& res) = 0;
+    // Duration of the phases of the command, in microseconds.
+    virtual void timings(const std::vector<std::pair<std::string, double>>& phases) = 0;
     virtual void write() = 0;
     virtual ~CottonLogger() = default;
 };
@@ -49,6 +56,10 @@ public:
     void result(const space_limit_t& space) override;
     void result(const std::vector<std::pair<std::string, std::string>>& res) override;
     void result(const std::vector<std::tuple<std::string, int, std::vector<std::string>>>& res) override;
+    void result(const RunResult& res) override;
+    void result(const std::vector<RunResult>& res) override;
+    void result(const std::vector<ExportedFile>& res) override;
+    void timings(const std::vector<std::pair<std::string, double>>& phases) override;
     void write() override {};
 };
 
@@ -56,8 +67,10 @@ class CottonJSONLogger: public CottonLogger {
     json_raw_string result_ = "null";
     std::vector<std::pair<int, std::string>> errors;
     std::vector<std::pair<int, std::string>> warnings;
+    json_raw_string timings_ = "";
+    std::ostream& out;
 public:
-    using CottonLogger::CottonLogger;
+    CottonJSONLogger(std::ostream& out = std::cout): out(out) {}
     bool isttylogger() override {return false;};
     void error(int code, const std::string& error) override;
     void warning(int code, const std::string& warning) override;
@@ -68,6 +81,10 @@ public:
     void result(const space_limit_t& space) override;
     void result(const std::vector<std::pair<std::string, std::string>>& res) override;
     void result(const std::vector<std::tuple<std::string, int, std::vector<std::string>>>& res) override;
+    void result(const RunResult& res) override;
+    void result(const std::vector<RunResult>& res) override;
+    void result(const std::vector<ExportedFile>& res) override;
+    void timings(const std::vector<std::pair<std::string, double>>& phases) override;
     void write() override;
 };
 
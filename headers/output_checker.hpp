@@ -0,0 +1,51 @@
+#ifndef COTTON_OUTPUT_CHECKER_HPP
+#define COTTON_OUTPUT_CHECKER_HPP
+#include "util.hpp"
+#ifdef COTTON_UNIX
+#include <string>
+
+// Compares the output of a program with the expected one while it is being
+// written, so that a wrong output is found at its first difference. The
+// expected output is mapped in memory.
+class OutputChecker {
+public:
+    enum class Mode {
+        exact,  // Byte by byte
+        tokens, // Whitespace separated tokens, ignoring the amount of whitespace
+        floats  // Like tokens, comparing numbers with a tolerance
+    };
+    static bool parse_mode(const std::string& name, Mode& mode);
+
+private:
+    const char* expected = nullptr;
+    size_t size = 0;
+    size_t pos = 0;
+    Mode mode = Mode::exact;
+    double tolerance = 0;
+    std::string token; // The output token being read
+    size_t token_limit = 0; // Longest allowed output token, 0 until it is needed
+    size_t token_count = 0;
+    std::string mismatch_;
+    // Finds the next expected token, without consuming it.
+    size_t next_token(size_t& begin) const;
+    bool same_token(const char* exp, size_t len) const;
+    bool check_token();
+
+public:
+    OutputChecker() {}
+    OutputChecker(const OutputChecker&) = delete;
+    OutputChecker& operator=(const OutputChecker&) = delete;
+    ~OutputChecker();
+
+    // Maps the expected output, returning false with errno set on errors.
+    bool open(const std::string& path, Mode mode, double tolerance);
+    // Checks the next part of the output. Returns false if it is wrong.
+    bool feed(const char* data, size_t len);
+    // Checks that nothing is missing at the end of the output.
+    bool finish();
+    // What is wrong in the output, once feed or finish returned false.
+    const std::string& mismatch() const {return mismatch_;}
+};
+
+#endif
+#endif
@@ -0,0 +1,56 @@
+#ifndef COTTON_PERF_COUNTERS_HPP
+#define COTTON_PERF_COUNTERS_HPP
+#include "util.hpp"
+#ifdef COTTON_LINUX
+#include <cstdint>
+#include <string>
+#include <signal.h>
+
+// Hardware performance counters of a program, from perf_event_open. They only
+// count in user space, which is allowed up to perf_event_paranoid 2, and they
+// include the processes forked by the program once they exit. The counters
+// are opened by the program itself right before exec, and they start at the
+// exec; they are then passed to the parent, which reads them.
+class PerfCounters {
+public:
+    enum counter_t {instructions, cycles, task_clock, counter_count};
+
+private:
+    int fds[counter_count];
+    int signal_fd = -1;
+    sigset_t saved_mask;
+
+public:
+    PerfCounters() {
+        for (auto& fd: fds) fd = -1;
+    }
+    PerfCounters(const PerfCounters&) = delete;
+    PerfCounters& operator=(const PerfCounters&) = delete;
+    ~PerfCounters() {close();}
+
+    // Empty if the counters can be used on this system, the reason why they
+    // cannot otherwise. The check is done only once.
+    static const std::string& unavailable_reason();
+    static bool is_available() {return unavailable_reason().empty();}
+
+    // Opens the counters on the calling process. With an instruction_limit,
+    // the instruction counter overflows after that many instructions. The
+    // counters the hardware lacks are set to -1. Returns false with errno set
+    // if the instructions cannot be counted.
+    static bool open(uint64_t instruction_limit, int fds[counter_count]);
+
+    // Takes the counters opened by the program. If watch_overflow is set, the
+    // overflows of the instruction counter make overflow_fd readable, and the
+    // counters must not have started yet.
+    bool attach(const int fds[counter_count], bool watch_overflow);
+    bool is_attached() const {return fds[instructions] != -1;}
+    // Readable when the instruction limit is reached, -1 if not watched.
+    int overflow_fd() const {return signal_fd;}
+    // Current value of a counter, in nanoseconds for task_clock, or 0 if it is
+    // not available.
+    uint64_t get(counter_t counter) const;
+    void close();
+};
+
+#endif
+#endif
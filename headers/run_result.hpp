@@ -0,0 +1,47 @@
+#ifndef COTTON_RUN_RESULT_HPP
+#define COTTON_RUN_RESULT_HPP
+#include <cstdint>
+#include <string>
+#include "util.hpp"
+
+// Everything that is known about the last command run in a box. The fields
+// that the sandbox cannot measure are left to zero.
+struct RunResult {
+    bool success = false; // The command was started and waited for
+    std::string status;   // Exit reason, as returned by get_status
+    int return_code = 0;
+    int signal = 0;
+    time_limit_t running_time = 0;
+    time_limit_t wall_time = 0;
+    space_limit_t memory_usage = 0;
+    int cpu = -1;         // The cpu the box was pinned to, if any
+    // From the performance counters, when they are enabled.
+    uint64_t instructions = 0;
+    uint64_t cycles = 0;
+    time_limit_t task_clock = 0;
+    // "Correct", or what is wrong in the output, when it is checked.
+    std::string verdict;
+    template <typename Archive> void serialize(Archive &ar, const unsigned int version) {
+        ar & success;
+        ar & status;
+        ar & return_code;
+        ar & signal;
+        ar & running_time;
+        ar & wall_time;
+        ar & memory_usage;
+        ar & cpu;
+        ar & instructions;
+        ar & cycles;
+        ar & task_clock;
+        ar & verdict;
+    }
+};
+
+// A file that export_files wrote out of a box.
+struct ExportedFile {
+    std::string path;       // Relative to the root of the box
+    size_t size = 0;        // The bytes written after the header
+    bool truncated = false; // The file was longer than the size cap
+};
+
+#endif
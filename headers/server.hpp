@@ -0,0 +1,35 @@
+#ifndef COTTON_SERVER_HPP
+#define COTTON_SERVER_HPP
+#include <istream>
+#include <ostream>
+#include <string>
+
+// Runs commands received on a Unix socket, keeping the boxes in memory between
+// commands. Every request and every reply is a JSON document preceded by its
+// length as a 32 bit unsigned integer in network byte order. Requests are the
+// command objects accepted by commands::execute, replies are the objects
+// written by CottonJSONLogger. A request can come with file descriptors, passed
+// with SCM_RIGHTS: its "fd:N" redirections then refer to the N-th of them. They
+// are kept open until the connection is closed. Many clients can stay connected
+// at the same time: their requests are run one at a time, in the order they
+// arrive. A client that takes more than 10 seconds to send the rest of a
+// request, or to read a reply, is disconnected. Returns only on errors.
+bool serve(const std::string& box_root, const std::string& socket_path);
+
+// Executes a single JSON command object, writing the CottonJSONLogger reply to
+// out. The global logger is replaced for the duration of the command.
+void handle_request(const std::string& box_root, const std::string& request, std::ostream& out);
+
+// Runs the commands read from the given stream, one JSON command object per
+// line, writing the reply to each of them on a line of standard output.
+// Returns the number of executed commands.
+size_t run_batch(const std::string& box_root, std::istream& in);
+
+// Like run_batch, but the run and run-many commands are executed in parallel,
+// each in its own process with the box pinned to a physical core that no other
+// box is using, and only when such a core is free. The other commands wait for
+// the runs on their box to finish. The replies are written in the order of the
+// commands.
+size_t run_parallel_batch(const std::string& box_root, std::istream& in);
+
+#endif
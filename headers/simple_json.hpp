@@ -2,6 +2,7 @@
 #define COTTON_SIMPLE_JSON_HPP
 #include <string>
 #include <vector>
+#include <map>
 
 class json_raw_string: public std::string {
 public:
@@ -58,8 +59,37 @@ json_raw_string to_json_obj(const std::vector<std::pair<std::string, T>>& obj) {
     std::string res = "{";
     for (unsigned i=0; i<obj.size(); i++) {
         res += to_json(obj[i].first) + ": " + to_json(obj[i].second);
-        if (i+1 != res.size()) res += ", ";
+        if (i+1 != obj.size()) res += ", ";
     }
     return res + "}";
 }
+
+class json_value {
+public:
+    enum type_t {null_type, bool_type, number_type, string_type, array_type, object_type};
+private:
+    type_t type_ = null_type;
+    bool bool_ = false;
+    double number_ = 0;
+    std::string string_;
+    std::vector<json_value> array_;
+    std::map<std::string, json_value> object_;
+    friend class json_parser;
+public:
+    // Throws std::runtime_error if the string is not valid JSON.
+    static json_value parse(const std::string& str);
+    type_t type() const {return type_;}
+    bool is_null() const {return type_ == null_type;}
+    bool is_number() const {return type_ == number_type;}
+    bool is_string() const {return type_ == string_type;}
+    bool is_array() const {return type_ == array_type;}
+    bool is_object() const {return type_ == object_type;}
+    // The accessors throw std::runtime_error if the value has the wrong type.
+    bool as_bool() const;
+    double as_number() const;
+    const std::string& as_string() const;
+    const std::vector<json_value>& as_array() const;
+    bool has(const std::string& key) const;
+    const json_value& operator[](const std::string& key) const;
+};
 #endif
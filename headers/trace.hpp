@@ -0,0 +1,53 @@
+#ifndef COTTON_TRACE_HPP
+#define COTTON_TRACE_HPP
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Timestamps of the phases of a command, to find out where its latency goes.
+// The events live in memory shared with the forked children, so the phases
+// that run in the box before the exec are recorded too. Nothing is recorded
+// unless tracing was started.
+namespace trace {
+struct Event {
+    char name[32];
+    int32_t pid;
+    uint64_t start; // CLOCK_MONOTONIC, in nanoseconds
+    uint64_t end;   // 0 while the phase is running
+};
+
+// Starts recording, dropping the events recorded before.
+void start();
+void stop();
+bool is_active();
+
+// Starts a phase in this process.
+void begin(const char* name);
+// Ends the last started phase with the given name, in any process.
+void end(const char* name);
+
+class Phase {
+    const char* name;
+public:
+    Phase(const char* name): name(name) {begin(name);}
+    Phase(const Phase&) = delete;
+    Phase& operator=(const Phase&) = delete;
+    // Ends the phase before the end of the scope.
+    void end() {
+        if (name != nullptr) trace::end(name);
+        name = nullptr;
+    }
+    ~Phase() {end();}
+};
+
+std::vector<Event> events();
+// Total duration of the completed phases with each name, in microseconds, in
+// order of first start.
+std::vector<std::pair<std::string, double>> durations();
+// The events in the Chrome trace event format.
+std::string chrome_trace();
+bool write_chrome_trace(const std::string& path);
+}
+
+#endif
@@ -29,8 +29,26 @@
 #include <boost/archive/text_iarchive.hpp>
 
 std::string serror(const std::string& base, int err = errno);
-int rm_rf(const std::string& fld);
+// Recursively deletes a folder, returning 0 or an errno value. With more
+// than one thread, the subfolders are emptied in parallel.
+int rm_rf(const std::string& fld, unsigned threads = 1);
+// Moves a folder into trash_dir and deletes it in a background process, so
+// that the caller does not have to wait. Falls back to rm_rf if the folder
+// cannot be moved.
+int rm_rf_async(const std::string& fld, const std::string& trash_dir);
 int mkdirs(const std::string& path, mode_t mode);
+// Read or send exactly len bytes, retrying on EINTR. send_all works only on
+// sockets, and does not raise SIGPIPE.
+bool read_all(int fd, void* buf, size_t len);
+bool send_all(int fd, const void* buf, size_t len);
+// Like send_all and read_all, passing up to 8 file descriptors along with the
+// data. On input count is the size of fds, on output the number of
+// descriptors received; the extra ones are closed.
+bool send_fds(int sock, const void* buf, size_t len, const int* fds, size_t count);
+bool receive_fds(int sock, void* buf, size_t len, int* fds, size_t& count);
+// Returns a file descriptor that becomes readable when the process exits, or
+// -1 if the kernel does not support pidfds.
+int open_pidfd(pid_t pid);
 
 struct Privileged {
     static int counter;
@@ -55,7 +73,7 @@ public:
     constexpr time_limit_t(std::chrono::duration<Args...> duration):
         microsecs_(std::chrono::duration_cast<std::chrono::microseconds>(duration).count()) {}
     constexpr time_limit_t(struct timeval t):
-        microsecs_(t.tv_sec*1'000'000 + t.tv_usec/1000) {}
+        microsecs_(t.tv_sec*1'000'000 + t.tv_usec) {}
     friend class boost::serialization::access;
     template <typename Archive> void serialize(Archive &ar, const unsigned int version) {
         ar & microsecs_;
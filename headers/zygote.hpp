@@ -0,0 +1,55 @@
+#ifndef COTTON_ZYGOTE_HPP
+#define COTTON_ZYGOTE_HPP
+#include "util.hpp"
+#ifdef COTTON_LINUX
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+// A helper process that is set up once and then clones a new child for every
+// request it receives. The children are created with CLONE_PARENT, so they are
+// children of the process that sent the request and can be waited for as if
+// they were forked by it. Zygotes are only worth it when the same process
+// runs many commands: set_enabled tells the boxes to use them for every run,
+// otherwise they are only started for the runs that ask for them.
+class Zygote {
+public:
+    // Runs in the zygote right after it starts.
+    typedef std::function<bool()> setup_t;
+    // Runs in every child, with the request and the file descriptors sent
+    // with it. It must not return.
+    typedef std::function<void(const std::string&, const std::vector<int>&)> child_t;
+
+private:
+    pid_t pid = -1;
+    int sock = -1;
+    std::string key;
+    Zygote() {}
+    [[noreturn]] void zygote_main(unsigned long clone_flags, const setup_t& setup, const child_t& child);
+    static bool enabled_;
+
+public:
+    Zygote(const Zygote&) = delete;
+    Zygote& operator=(const Zygote&) = delete;
+    ~Zygote();
+
+    static void set_enabled(bool enabled);
+    static bool is_enabled() {return enabled_;}
+    // In a child forked by a process with zygotes, disables them and forgets
+    // the ones of the parent without stopping them: their children would be
+    // siblings of this process, which could not wait for them.
+    static void disable_after_fork();
+    // Returns the zygote with the given name, starting it if it is not running
+    // or if it was set up with a different key. Returns nullptr on errors.
+    static Zygote* get(const std::string& name, const std::string& key, unsigned long clone_flags,
+        const setup_t& setup, const child_t& child);
+    static void stop(const std::string& name);
+
+    // Asks the zygote for a new child, passing it up to 8 file descriptors.
+    // Returns the pid of the child or -1 with errno set.
+    pid_t spawn(const std::string& request, const std::vector<int>& fds);
+};
+
+#endif
+#endif
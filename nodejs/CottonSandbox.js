@@ -26,6 +26,18 @@ const childProcess = require('child_process');
 const path = require('path');
 const should = require('should/as-function');
 
+// The native addon runs the commands in this process. Without it, every call
+// spawns the cotton executable in batch mode.
+let addon = null;
+try {
+  addon = require('../build/Release/cotton.node');
+} catch (err) {
+  addon = null;
+}
+
+// Folder with the boxes, the default one of the cotton executable.
+const boxRoot = '/tmp';
+
 /**
  * Cotton node interface
  * =====================
@@ -44,7 +56,7 @@ module.exports = class CottonSandbox {
   constructor(boxType) {
     should(boxType).be.String();
 
-    const sandboxId = parseInt(this._execute(['create', boxType]));
+    const sandboxId = parseInt(this._command({cmd: 'create', box_type: boxType}));
     should(sandboxId).be.Number('Error while creating the box');
 
     this._boxType = boxType;
@@ -57,7 +69,7 @@ module.exports = class CottonSandbox {
    * this.
    */
   destroy() {
-    this._executeOnSandbox(['destroy']);
+    this._command({cmd: 'destroy'});
   }
 
   /**
@@ -115,7 +127,7 @@ module.exports = class CottonSandbox {
         .be.a.Number()
         .and.not.be.Infinity()
         .and.be.above(0);
-    this._executeOnSandbox(['cpu-limit', time]);
+    this._command({cmd: 'cpu-limit', value: time});
     return this;
   }
 
@@ -131,7 +143,7 @@ module.exports = class CottonSandbox {
         .be.a.Number()
         .and.not.be.Infinity()
         .and.be.above(0);
-    this._executeOnSandbox(['wall-limit', time]);
+    this._command({cmd: 'wall-limit', value: time});
     return this;
   }
 
@@ -159,7 +171,63 @@ module.exports = class CottonSandbox {
         .be.a.Number()
         .and.not.be.Infinity()
         .and.be.above(0);
-    this._executeOnSandbox(['memory-limit', memory]);
+    this._command({cmd: 'memory-limit', value: memory});
+    return this;
+  }
+
+  /**
+   * Sets the maximum number of instructions of a command execution. Unlike
+   * the CPU time, it does not depend on the load of the machine. It needs
+   * hardware performance counters, which are often missing in virtual
+   * machines.
+   *
+   * @param {number} instructions the instruction limit, 0 for none.
+   * @return {CottonSandbox} the current object for chaining.
+   */
+  instructionLimit(instructions) {
+    should(instructions)
+        .be.a.Number()
+        .and.not.be.Infinity()
+        .and.not.be.below(0);
+    this._command({cmd: 'instruction-limit', value: instructions});
+    return this;
+  }
+
+  /**
+   * Compares the standard output of the next commands with a file while they
+   * run. A command that writes a wrong output is killed as soon as the first
+   * difference is read.
+   *
+   * @param {string} expected the path of the expected output, '' for none.
+   * @param {?string} mode exact (the default), tokens (ignoring the amount
+   *                  of whitespace) or floats (tokens, with numbers compared
+   *                  with a tolerance).
+   * @param {?number} tolerance the absolute or relative error allowed on
+   *                  numbers in floats mode.
+   * @return {CottonSandbox} the current object for chaining.
+   */
+  outputCheck(expected, mode, tolerance) {
+    should(expected).be.a.String();
+    this._command({
+      cmd: 'output-check',
+      value: expected,
+      mode: mode || 'exact',
+      tolerance: tolerance || 0,
+    });
+    return this;
+  }
+
+  /**
+   * Allows only the syscalls of a profile to the next commands. A command
+   * that makes another syscall is killed, with the status
+   * 'Forbidden syscall N'. It needs a SeccompSandbox.
+   *
+   * @param {string} profile program, python, compiler, or '' for no filter.
+   * @return {CottonSandbox} the current object for chaining.
+   */
+  syscallProfile(profile) {
+    should(profile).be.a.String();
+    this._command({cmd: 'syscall-profile', value: profile});
     return this;
   }
 
@@ -174,7 +242,7 @@ module.exports = class CottonSandbox {
         .be.a.Number()
         .and.not.be.Infinity()
         .and.be.above(0);
-    this._executeOnSandbox(['disk-limit', memory]);
+    this._command({cmd: 'disk-limit', value: memory});
     return this;
   }
 
@@ -191,6 +259,16 @@ module.exports = class CottonSandbox {
     return this;
   }
 
+  /**
+   * Deletes every file in the sandbox'd directory, keeping the limits.
+   *
+   * @return {CottonSandbox} the current object for chaining.
+   */
+  clear() {
+    this._command({cmd: 'clear'});
+    return this;
+  }
+
   /**
    * Runs a command. The command will be interpreted as a relative path inside
    * the sandbox'd directory.
@@ -204,26 +282,72 @@ module.exports = class CottonSandbox {
    *                  - wallTime
    *                  - memoryPeak (MRSS)
    *                  - signal
+   *                  - status (the exit reason)
+   *                  - instructions, cycles (0 without an instruction
+   *                    limit or when the counters are not available)
+   *                  - verdict ('Correct' or what is wrong in the output,
+   *                    '' without an output check)
    */
   run(command, args) {
-    should(command).be.String();
-    if (_.isNil(args)) {
-      args = [];
-    } else {
-      args = _.castArray(args);
-    }
+    return this._runResult(this._commands(this._runCommands(command, args)));
+  }
 
-    args.unshift('run', command);
-    this._executeOnSandbox(args);
+  /**
+   * Same as `run()`, but without blocking the event loop while the command
+   * runs.
+   *
+   * @param {!string} command the command.
+   * @param {?Array} args the arguments.
+   * @return {Promise} a promise of the execution status returned by `run()`.
+   */
+  runAsync(command, args) {
+    return this._commandsAsync(this._runCommands(command, args))
+        .then(results => this._runResult(results));
+  }
 
-    const ret = {};
-    ret.returnCode = this.returnCode();
-    ret.cpuTime = this.cpuTime();
-    ret.wallTime = this.wallTime();
-    ret.memory = this.memoryPeak();
-    ret.signal = this.signal();
+  /**
+   * Runs a command once for every pair of stdin and stdout files, with the
+   * same limits. The files are relative to the sandbox'd directory.
+   *
+   * @param {!string} command the command.
+   * @param {?Array} args the arguments.
+   * @param {!Array} cases the [stdin, stdout] pairs.
+   * @return {Array} the execution status of each run, as returned by `run()`.
+   */
+  runMany(command, args, cases) {
+    should(cases).be.an.Array();
+    const run = this._runCommands(command, args)[0];
+    const results = this._command(_.assign(run, {
+      cmd: 'run-many',
+      cases: cases,
+    }));
+    return results.map(result => this._runResult([result]));
+  }
 
-    return ret;
+  /**
+   * Runs a command together with a manager in another sandbox, the output of
+   * each one being the input of the other. Both are killed as soon as one of
+   * them fails.
+   *
+   * @param {!string} command the command.
+   * @param {?Array} args the arguments.
+   * @param {!CottonSandbox} manager the sandbox of the manager.
+   * @param {!string} managerCommand the command of the manager.
+   * @param {?Array} managerArgs the arguments of the manager.
+   * @return {Array} the execution status of the command and of the manager,
+   *                 as returned by `run()`.
+   */
+  runInteractive(command, args, manager, managerCommand, managerArgs) {
+    should(manager).be.an.instanceOf(CottonSandbox);
+    const run = this._runCommands(command, args)[0];
+    const managerRun = manager._runCommands(managerCommand, managerArgs)[0];
+    const results = this._command(_.assign(run, {
+      cmd: 'run-interactive',
+      manager_box: manager._sandboxId,
+      manager_exec: managerRun.exec,
+      manager_args: managerRun.args,
+    }));
+    return results.map(result => this._runResult([result]));
   }
 
   /**
@@ -232,7 +356,20 @@ module.exports = class CottonSandbox {
    * @return {Number}
    */
   returnCode() {
-    return parseInt(this._executeOnSandbox(['return-code']));
+    return parseInt(this._command({cmd: 'return-code'}));
+  }
+
+  /**
+   * Retrieves what the last command wrote to a stream redirected to 'memfd'.
+   * The output is kept in the memory of the process that runs the sandbox, so
+   * this needs the native addon.
+   *
+   * @param {!string} stream the name of the stream (stdout or stderr).
+   * @return {string} the output.
+   */
+  output(stream) {
+    should(stream).be.equalOneOf(['stdout', 'stderr']);
+    return this._command({cmd: 'output', stream: stream});
   }
 
   /**
@@ -241,7 +378,7 @@ module.exports = class CottonSandbox {
    * @return {Number}
    */
   cpuTime() {
-    return parseInt(this._executeOnSandbox(['running-time']));
+    return Math.round(this._command({cmd: 'running-time'}) * 1e6);
   }
 
   /**
@@ -250,7 +387,7 @@ module.exports = class CottonSandbox {
    * @return {Number}
    */
   wallTime() {
-    return parseInt(this._executeOnSandbox(['wall-time']));
+    return Math.round(this._command({cmd: 'wall-time'}) * 1e6);
   }
 
   /**
@@ -260,7 +397,7 @@ module.exports = class CottonSandbox {
    * @return {Number}
    */
   memoryPeak() {
-    return parseInt(this._executeOnSandbox(['memory-usage']));
+    return parseInt(this._command({cmd: 'memory-usage'}));
   }
 
   /**
@@ -269,7 +406,7 @@ module.exports = class CottonSandbox {
    * @return {Number}
    */
   signal() {
-    return parseInt(this._executeOnSandbox(['signal']));
+    return parseInt(this._command({cmd: 'signal'}));
   }
 
   /**
@@ -312,6 +449,50 @@ module.exports = class CottonSandbox {
     return this;
   }
 
+  /**
+   * Puts a file or a folder in the sandbox. The files are stored once for all
+   * the sandboxes, and may be shared with them when they are read-only.
+   *
+   * @param {!string} filePath File or folder path.
+   * @param {!string} destination Path relative to the box root.
+   * @param {?boolean} writable whether the program can modify the files.
+   * @return {CottonSandbox} the current object for chaining
+   */
+  importFile(filePath, destination, writable) {
+    should(filePath).be.String();
+    should(destination).be.String();
+
+    this._command({
+      cmd: 'import',
+      internal_path: destination,
+      external_path: filePath,
+      rw: !!writable,
+    });
+    return this;
+  }
+
+  /**
+   * Writes files of the sandbox to a file descriptor or to a unix socket,
+   * each one after a line with its size, 1 if it was cut at maxSize or else
+   * 0, and its path.
+   *
+   * @param {!Array<string>} files paths in the sandbox, with wildcards.
+   * @param {!string} to "fd:N" or the path of a unix socket.
+   * @param {?number} maxSize the size in KiB after which each file is cut.
+   * @return {Array<Object>} path, size and truncated of every file written.
+   */
+  exportFiles(files, to, maxSize) {
+    should(files).be.an.Array();
+    should(to).be.String();
+
+    return this._command({
+      cmd: 'export',
+      files: files,
+      to: to,
+      max_size: maxSize || 0,
+    });
+  }
+
   /**
    * Enable a path in the sandbox (read-only).
    *
@@ -322,7 +503,11 @@ module.exports = class CottonSandbox {
     should(internalPath).be.String();
     should(path).be.String();
 
-    this._executeOnSandbox(['mount', internalPath, path]);
+    this._command({
+      cmd: 'mount',
+      internal_path: internalPath,
+      external_path: path,
+    });
   }
 
   /**
@@ -335,44 +520,147 @@ module.exports = class CottonSandbox {
     should(internalPath).be.String();
     should(path).be.String();
 
-    this._executeOnSandbox(['mount', '--rw', internalPath, path]);
+    this._command({
+      cmd: 'mount',
+      internal_path: internalPath,
+      external_path: path,
+      rw: true,
+    });
   }
 
 
   /**
-   * Runs a command calling `cotton -j ...`.
+   * Executes cotton commands on this sandbox, all with a single call to the
+   * addon or to `cotton batch`.
    *
    * @private
-   * @param {Array} args the command to run with its arguments.
-   * @return {Object} the JSON returned by Cotton.
+   * @param {Array} commands the command objects, as accepted by cotton batch.
+   * @return {Array} the results of the commands.
    */
-  _execute(args) {
-    should(args).be.an.Array();
+  _commands(commands) {
+    const requests = this._requests(commands);
+    if (addon) {
+      return this._results(addon.execute(boxRoot, requests));
+    }
+    const output = childProcess.spawnSync('cotton', ['-j', 'batch'], {
+      input: requests.join('\n') + '\n',
+    }).stdout.toString('utf-8');
+    return this._results(output.split('\n').slice(0, requests.length));
+  }
 
-    // Force json output.
-    args.unshift('-j');
+  /**
+   * Asynchronous version of `_commands()`.
+   *
+   * @private
+   * @param {Array} commands the command objects, as accepted by cotton batch.
+   * @return {Promise} a promise of the results of the commands.
+   */
+  _commandsAsync(commands) {
+    const requests = this._requests(commands);
+    if (addon) {
+      return addon.executeAsync(boxRoot, requests)
+          .then(replies => this._results(replies));
+    }
+    return new Promise((resolve, reject) => {
+      const child = childProcess.execFile('cotton', ['-j', 'batch'],
+          (err, stdout) => {
+            if (err) {
+              reject(err);
+              return;
+            }
+            try {
+              resolve(this._results(
+                  stdout.split('\n').slice(0, requests.length)));
+            } catch (e) {
+              reject(e);
+            }
+          });
+      child.stdin.end(requests.join('\n') + '\n');
+    });
+  }
 
-    // Spawn the command.
-    const rawOutput = childProcess.spawnSync('cotton', args).stdout
-        .toString('utf-8');
-    const outcome = JSON.parse(rawOutput);
+  /**
+   * Executes a single cotton command on this sandbox.
+   *
+   * @private
+   * @param {Object} command the command object.
+   * @return {Object} the result of the command.
+   */
+  _command(command) {
+    return this._commands([command])[0];
+  }
+
+  /**
+   * Serializes the commands, adding the id of the sandbox if it exists.
+   *
+   * @private
+   * @param {Array} commands the command objects.
+   * @return {Array} the JSON requests.
+   */
+  _requests(commands) {
+    return commands.map(command => {
+      if (!_.isNil(this._sandboxId)) {
+        command = _.assign({box: this._sandboxId}, command);
+      }
+      return JSON.stringify(command);
+    });
+  }
 
-    if (!_.isEmpty(outcome.errors)) {
-      throw new Error(JSON.stringify(outcome.errors));
+  /**
+   * Parses the replies of cotton, throwing on the first error.
+   *
+   * @private
+   * @param {Array} replies the JSON replies.
+   * @return {Array} the results.
+   */
+  _results(replies) {
+    return replies.map(reply => {
+      const outcome = JSON.parse(reply);
+      if (!_.isEmpty(outcome.errors)) {
+        throw new Error(JSON.stringify(outcome.errors));
+      }
+      return outcome.result;
+    });
+  }
+
+  /**
+   * The command that runs a program.
+   *
+   * @private
+   * @param {!string} command the command.
+   * @param {?Array} args the arguments.
+   * @return {Array} the command objects.
+   */
+  _runCommands(command, args) {
+    should(command).be.String();
+    if (_.isNil(args)) {
+      args = [];
+    } else {
+      args = _.castArray(args).map(String);
     }
-    return outcome.result;
+    return [{cmd: 'run', exec: command, args: args}];
   }
 
   /**
-   * Runs a command calling `cotton -j -b {sandboxId} ...`.
+   * Builds the execution status from the result of the run command.
    *
    * @private
-   * @param {Array} args the arguments.
-   * @return {Object} the JSON returned by Cotton.
+   * @param {Array} results the results of the commands.
+   * @return {Object} the execution status.
    */
-  _executeOnSandbox(args) {
-    args.unshift('-b', this._sandboxId);
-    return this._execute(args);
+  _runResult(results) {
+    const result = results[0];
+    return {
+      returnCode: result.return_code,
+      cpuTime: Math.round(result.running_time * 1e6),
+      wallTime: Math.round(result.wall_time * 1e6),
+      memory: result.memory_usage,
+      signal: result.signal,
+      status: result.status,
+      instructions: result.instructions,
+      cycles: result.cycles,
+      verdict: result.verdict,
+    };
   }
 
   /**
@@ -388,7 +676,7 @@ module.exports = class CottonSandbox {
     should(filename).be.String();
     should(filename.length).be.above(0);
 
-    this._executeOnSandbox(['redirect', stream, filename]);
+    this._command({cmd: 'redirect', stream: stream, value: filename});
     return this;
   }
 };
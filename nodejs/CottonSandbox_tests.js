@@ -20,8 +20,26 @@ limitations under the License.
 'use strict';
 
 import test from 'ava';
+import childProcess from 'child_process';
+import fs from 'fs';
 import CottonSandbox from './CottonSandbox.js';
 
+// Runs the requests in a single cotton process in batch mode, and returns the
+// parsed replies, timings included.
+function batch(requests) {
+  const input = requests.map(request => JSON.stringify(request)).join('\n');
+  const output = childProcess.execFileSync('cotton', ['-j', 'batch'],
+      {input: input + '\n'});
+  return output.toString().split('\n').slice(0, requests.length)
+      .map(reply => JSON.parse(reply));
+}
+
+// Makes the programs of the system visible in the sandbox.
+function mountSystem(sandbox) {
+  ['/bin', '/lib', '/lib64', '/sbin', '/usr'].filter(dir => fs.existsSync(dir))
+      .forEach(dir => sandbox.mountRO(dir, dir));
+}
+
 test('sandbox creation, type DummyUnixSandbox', t => {
   const sandbox = new CottonSandbox('DummyUnixSandbox');
 
@@ -46,3 +64,43 @@ test('ls works, type DummyUnixSandbox', t => {
 
   sandbox.destroy();
 });
+
+test('async run, type DummyUnixSandbox', async t => {
+  const sandbox = new CottonSandbox('DummyUnixSandbox');
+
+  sandbox.symlink('/bin/ls', 'ls');
+  const outcome = await sandbox.stdout('ls_output').runAsync('ls');
+
+  t.is(outcome.returnCode, 0);
+  t.is(sandbox.readFile('ls_output'), 'ls\nls_output\n');
+
+  sandbox.destroy();
+});
+
+test('zygote reused with mounts, type NamespaceSandbox', t => {
+  const sandbox = new CottonSandbox('NamespaceSandbox');
+
+  mountSystem(sandbox);
+  const run = {box: sandbox._sandboxId, cmd: 'run', exec: '/bin/true',
+    args: [], timings: true};
+  const replies = batch([run, run]);
+
+  replies.forEach(reply => t.is(reply.result.return_code, 0));
+  t.truthy(replies[1].timings.zygote_spawn);
+
+  sandbox.destroy();
+});
+
+test('disk limit with a syscall profile, type SeccompSandbox', t => {
+  const sandbox = new CottonSandbox('SeccompSandbox');
+
+  mountSystem(sandbox);
+  sandbox.diskLimit(10).syscallProfile('program');
+  // Statically linked, so that it opens no library under the disk limit.
+  const outcome = sandbox.run('/sbin/ldconfig', ['--version']);
+
+  t.is(outcome.status, 'Terminated normally');
+  t.is(outcome.returnCode, 0);
+
+  sandbox.destroy();
+});
@@ -0,0 +1,153 @@
+#include "commands.hpp"
+#include "logger.hpp"
+#include "server.hpp"
+#include "zygote.hpp"
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <node_api.h>
+
+BoxCreators* box_creators;
+CottonLogger* logger;
+
+// Node.js binding, exposing the JSON commands of the batch mode:
+//   execute(boxRoot, requests) returns the replies to an array of requests
+//   executeAsync(boxRoot, requests) does the same on a worker thread, and
+//     returns a Promise of the replies
+// Requests and replies are JSON strings, as in serve mode. The boxes are kept
+// in memory between calls.
+namespace {
+// The sandboxes use the global logger and change the process credentials, so
+// only one command can be executed at a time.
+std::mutex cotton_mutex;
+
+std::vector<std::string> execute(const std::string& box_root, const std::vector<std::string>& requests) {
+    std::lock_guard<std::mutex> lock(cotton_mutex);
+    std::vector<std::string> replies;
+    for (const auto& request: requests) {
+        std::ostringstream reply;
+        handle_request(box_root, request, reply);
+        std::string r = reply.str();
+        while (!r.empty() && r.back() == '\n') r.pop_back();
+        replies.push_back(r);
+    }
+    return replies;
+}
+
+bool get_string(napi_env env, napi_value value, std::string& str) {
+    size_t len;
+    if (napi_get_value_string_utf8(env, value, nullptr, 0, &len) != napi_ok) return false;
+    std::vector<char> buf(len + 1);
+    if (napi_get_value_string_utf8(env, value, buf.data(), buf.size(), &len) != napi_ok) return false;
+    str.assign(buf.data(), len);
+    return true;
+}
+
+// Reads the (boxRoot, requests) arguments, throwing a TypeError if they are
+// not a string and an array of strings.
+bool get_arguments(napi_env env, napi_callback_info info, std::string& box_root, std::vector<std::string>& requests) {
+    size_t argc = 2;
+    napi_value argv[2];
+    if (napi_get_cb_info(env, info, &argc, argv, nullptr, nullptr) != napi_ok) return false;
+    bool is_array = false;
+    uint32_t len = 0;
+    if (argc < 2 || !get_string(env, argv[0], box_root) || napi_is_array(env, argv[1], &is_array) != napi_ok ||
+        !is_array || napi_get_array_length(env, argv[1], &len) != napi_ok) {
+        napi_throw_type_error(env, nullptr, "Expected a box root and an array of requests");
+        return false;
+    }
+    requests.resize(len);
+    for (uint32_t i=0; i<len; i++) {
+        napi_value request;
+        if (napi_get_element(env, argv[1], i, &request) != napi_ok || !get_string(env, request, requests[i])) {
+            napi_throw_type_error(env, nullptr, "The requests must be strings");
+            return false;
+        }
+    }
+    return true;
+}
+
+napi_value to_array(napi_env env, const std::vector<std::string>& replies) {
+    napi_value array;
+    napi_create_array_with_length(env, replies.size(), &array);
+    for (size_t i=0; i<replies.size(); i++) {
+        napi_value reply;
+        napi_create_string_utf8(env, replies[i].data(), replies[i].size(), &reply);
+        napi_set_element(env, array, i, reply);
+    }
+    return array;
+}
+
+napi_value execute_sync(napi_env env, napi_callback_info info) {
+    std::string box_root;
+    std::vector<std::string> requests;
+    if (!get_arguments(env, info, box_root, requests)) return nullptr;
+    return to_array(env, execute(box_root, requests));
+}
+
+struct async_execution_t {
+    napi_async_work work;
+    napi_deferred deferred;
+    std::string box_root;
+    std::vector<std::string> requests;
+    std::vector<std::string> replies;
+};
+
+void execute_work(napi_env env, void* data) {
+    async_execution_t* e = (async_execution_t*)data;
+    e->replies = execute(e->box_root, e->requests);
+}
+
+void complete_work(napi_env env, napi_status status, void* data) {
+    async_execution_t* e = (async_execution_t*)data;
+    if (status == napi_ok) {
+        napi_resolve_deferred(env, e->deferred, to_array(env, e->replies));
+    } else {
+        napi_value message, error;
+        napi_create_string_utf8(env, "The commands were not executed", NAPI_AUTO_LENGTH, &message);
+        napi_create_error(env, nullptr, message, &error);
+        napi_reject_deferred(env, e->deferred, error);
+    }
+    napi_delete_async_work(env, e->work);
+    delete e;
+}
+
+napi_value execute_async(napi_env env, napi_callback_info info) {
+    std::unique_ptr<async_execution_t> e(new async_execution_t());
+    if (!get_arguments(env, info, e->box_root, e->requests)) return nullptr;
+    napi_value promise, name;
+    napi_create_promise(env, &e->deferred, &promise);
+    napi_create_string_utf8(env, "cotton", NAPI_AUTO_LENGTH, &name);
+    if (napi_create_async_work(env, nullptr, name, execute_work, complete_work, e.get(), &e->work) != napi_ok) {
+        napi_throw_error(env, nullptr, "Cannot create the async work");
+        return nullptr;
+    }
+    if (napi_queue_async_work(env, e->work) != napi_ok) {
+        napi_delete_async_work(env, e->work);
+        napi_throw_error(env, nullptr, "Cannot queue the async work");
+        return nullptr;
+    }
+    e.release();
+    return promise;
+}
+
+napi_value init(napi_env env, napi_value exports) {
+    // Only used outside of the commands, which get their own logger.
+    if (logger == nullptr) logger = new CottonJSONLogger(std::cerr);
+    set_box_cache(true);
+#ifdef COTTON_LINUX
+    // The boxes with namespaces are cloned by the zygotes, which have a single
+    // thread, and not by the threads of Node.js, since clone does not reset the
+    // locks of malloc as fork does.
+    Zygote::set_enabled(true);
+#endif
+    napi_value fn;
+    napi_create_function(env, "execute", NAPI_AUTO_LENGTH, execute_sync, nullptr, &fn);
+    napi_set_named_property(env, exports, "execute", fn);
+    napi_create_function(env, "executeAsync", NAPI_AUTO_LENGTH, execute_async, nullptr, &fn);
+    napi_set_named_property(env, exports, "executeAsync", fn);
+    return exports;
+}
+}
+
+NAPI_MODULE(NODE_GYP_MODULE_NAME, init)
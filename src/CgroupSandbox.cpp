@@ -0,0 +1,192 @@
+#include "util.hpp"
+#ifdef COTTON_LINUX
+#include "CgroupSandbox.hpp"
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <thread>
+#include <signal.h>
+#include <unistd.h>
+
+namespace {
+const char* const controllers = "+memory +pids";
+
+bool write_file(const std::string& path, const std::string& content) {
+    int fd = open(path.c_str(), O_WRONLY | O_CLOEXEC);
+    if (fd == -1) return false;
+    bool ok = write(fd, content.c_str(), content.size()) == (ssize_t)content.size();
+    int err = errno;
+    close(fd);
+    errno = err;
+    return ok;
+}
+
+// Returns the value of the given key in a flat-keyed cgroup file, like
+// cpu.stat or memory.events, or -1 if it is not there.
+long long read_key(const std::string& path, const std::string& key) {
+    std::ifstream fin(path);
+    std::string k;
+    long long value;
+    while (fin >> k >> value)
+        if (k == key) return value;
+    return -1;
+}
+
+long long read_value(const std::string& path) {
+    std::ifstream fin(path);
+    long long value;
+    if (fin >> value) return value;
+    return -1;
+}
+}
+
+std::string CgroupSandbox::cgroup_root() {
+    static std::string root = [] {
+        std::ifstream mounts("/proc/self/mounts");
+        std::string line;
+        while (std::getline(mounts, line)) {
+            std::istringstream fields(line);
+            std::string device, mountpoint, type;
+            fields >> device >> mountpoint >> type;
+            if (type == "cgroup2") return mountpoint;
+        }
+        return std::string();
+    }();
+    return root;
+}
+
+std::string CgroupSandbox::root_cgroup_path() const {
+    // Boxes with the same id under different base paths must not share their
+    // cgroup, so each base path gets its own, named after a hash (FNV-1a) of
+    // its canonical path.
+    char* real = realpath(base_path.c_str(), nullptr);
+    std::string path = real ? real : base_path;
+    free(real);
+    uint64_t hash = 14695981039346656037ULL;
+    for (unsigned char c: path) {
+        hash ^= c;
+        hash *= 1099511628211ULL;
+    }
+    char name[17];
+    snprintf(name, sizeof name, "%016llx", (unsigned long long)hash);
+    return cgroup_root() + "/cotton/root_" + name + "/";
+}
+
+std::string CgroupSandbox::cgroup_path() const {
+    return root_cgroup_path() + "box_" + std::to_string(id_) + "/";
+}
+
+bool CgroupSandbox::is_available() const {
+    if (!NamespaceSandbox::is_available() || cgroup_root() == "") return false;
+    std::ifstream fin(cgroup_root() + "/cgroup.controllers");
+    std::string controller;
+    int found = 0;
+    while (fin >> controller)
+        if (controller == "memory" || controller == "pids") found++;
+    return found == 2;
+}
+
+std::string CgroupSandbox::err_string(int error_id) const {
+    if (error_id == 200) return "Error joining the cgroup";
+    return NamespaceSandbox::err_string(error_id);
+}
+
+bool CgroupSandbox::remove_cgroup() {
+    Privileged p;
+    std::string path = cgroup_path();
+    if (access(path.c_str(), F_OK) == -1) return true;
+    // Kill anything that is left in the cgroup, then wait for it to die.
+    write_file(path + "cgroup.kill", "1");
+    for (int attempt = 0; attempt < 1000; attempt++) {
+        if (rmdir(path.c_str()) == 0 || errno == ENOENT) return true;
+        if (errno != EBUSY) break;
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    error(4, serror("Error removing the cgroup " + path));
+    return false;
+}
+
+bool CgroupSandbox::pre_fork_hook() {
+    if (!remove_cgroup()) return false;
+    {
+        Privileged p;
+        std::string parents[] = {cgroup_root() + "/", cgroup_root() + "/cotton/", root_cgroup_path()};
+        for (const auto& parent: parents) {
+            if (mkdir(parent.c_str(), 0755) == -1 && errno != EEXIST) {
+                error(4, serror("Error creating the cgroup " + parent));
+                return false;
+            }
+            // These fail if the controllers are already enabled by someone else.
+            write_file(parent + "cgroup.subtree_control", controllers);
+            // Optional, only needed to pin the box to a cpu.
+            if (cpu != -1) write_file(parent + "cgroup.subtree_control", "+cpuset");
+        }
+        std::string path = cgroup_path();
+        if (mkdir(path.c_str(), 0755) == -1) {
+            error(4, serror("Error creating the cgroup " + path));
+            return false;
+        }
+        std::string memory = mem_limit.bytes() ? std::to_string(mem_limit.bytes()) : "max";
+        std::string pids = process_limit ? std::to_string(process_limit) : "max";
+        if (!write_file(path + "memory.max", memory) || !write_file(path + "pids.max", pids)) {
+            error(4, serror("Error setting the cgroup limits"));
+            return false;
+        }
+        // Keeps also the processes that change their own affinity on the cpu.
+        if (cpu != -1 && !write_file(path + "cpuset.cpus", std::to_string(cpu)))
+            warning(4, serror("Error setting the cpuset of the cgroup"));
+        write_file(path + "memory.swap.max", "0"); // Missing without swap accounting
+        write_file(path + "memory.oom.group", "1");
+    }
+    return NamespaceSandbox::pre_fork_hook();
+}
+
+bool CgroupSandbox::post_fork_hook() {
+    {
+        Privileged p;
+        if (!write_file(cgroup_path() + "cgroup.procs", "0")) {
+            send_error(200, errno);
+            return false;
+        }
+    }
+    return NamespaceSandbox::post_fork_hook();
+}
+
+void CgroupSandbox::set_limits() {
+    // This runs in the child on its own copy of the box: memory and processes
+    // are limited by the cgroup, RLIMIT_AS and RLIMIT_NPROC would only get in
+    // the way.
+    mem_limit = 0;
+    process_limit = 0;
+    NamespaceSandbox::set_limits();
+}
+
+bool CgroupSandbox::box_checker(pid_t box_pid) {
+    if (!NamespaceSandbox::box_checker(box_pid)) return false;
+    std::string path = cgroup_path();
+    long long cpu_usage = read_key(path + "cpu.stat", "usage_usec");
+    if (cpu_usage != -1) running_time = time_limit_t::from_microseconds(cpu_usage);
+    long long memory_peak = read_value(path + "memory.peak"); // Linux 5.19+
+    if (memory_peak != -1) memory_usage = space_limit_t::from_bytes(memory_peak);
+    // The OOM killer sends SIGKILL, which also ends the runs stopped for any
+    // other reason: those keep their own status.
+    if (read_key(path + "memory.events", "oom_kill") > 0 && exit_status == "Signaled" && signal == SIGKILL)
+        exit_status = "Memory limit exceeded";
+    return true;
+}
+
+bool CgroupSandbox::sample_running_time(pid_t box_pid, time_limit_t& used) const {
+    long long cpu_usage = read_key(cgroup_path() + "cpu.stat", "usage_usec");
+    if (cpu_usage == -1) return NamespaceSandbox::sample_running_time(box_pid, used);
+    used = time_limit_t::from_microseconds(cpu_usage);
+    return true;
+}
+
+bool CgroupSandbox::cleanup_hook() {
+    bool ret = NamespaceSandbox::cleanup_hook();
+    return remove_cgroup() && ret;
+}
+
+REGISTER_SANDBOX(CgroupSandbox);
+#endif
@@ -1,22 +1,123 @@
 #include "util.hpp"
 #ifdef COTTON_UNIX
 #include "DummyUnixSandbox.hpp"
+#include "box_index.hpp"
+#include "trace.hpp"
+#include <algorithm>
 #include <limits>
 #include <chrono>
 #include <thread>
+#include <dirent.h>
+#include <glob.h>
+#include <poll.h>
 #include <signal.h>
 #include <sys/wait.h>
 #include <sys/resource.h>
+#include <sys/socket.h>
 #include <sys/stat.h>
+#ifdef COTTON_LINUX
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <sys/timerfd.h>
+#endif
+
+namespace {
+const size_t pipe_chunk = 1 << 16;
+
+bool write_all(int fd, const char* buf, size_t len) {
+    while (len > 0) {
+        ssize_t nwritten = write(fd, buf, len);
+        if (nwritten == -1 && errno == EINTR) continue;
+        if (nwritten <= 0) return false;
+        buf += nwritten;
+        len -= nwritten;
+    }
+    return true;
+}
+
+// Moves up to len bytes from a pipe to fd, without blocking on the pipe.
+ssize_t move_data(int pipe, int fd, size_t len) {
+#ifdef COTTON_LINUX
+    ssize_t n = splice(pipe, nullptr, fd, nullptr, len, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+    // fd does not support splice, e.g. it is opened with O_APPEND.
+    if (n != -1 || errno != EINVAL) return n;
+#endif
+    char buf[pipe_chunk];
+    ssize_t nread = read(pipe, buf, std::min(len, pipe_chunk));
+    if (nread <= 0) return nread;
+    return write_all(fd, buf, nread) ? nread : -1;
+}
+
+// Like write_all, waiting for fd when it is non-blocking.
+bool write_out(int fd, const char* buf, size_t len) {
+    while (len > 0) {
+        ssize_t nwritten = write(fd, buf, len);
+        if (nwritten == -1 && errno == EAGAIN) {
+            struct pollfd pfd = {fd, POLLOUT, 0};
+            poll(&pfd, 1, -1);
+            continue;
+        }
+        if (nwritten == -1 && errno == EINTR) continue;
+        if (nwritten <= 0) return false;
+        buf += nwritten;
+        len -= nwritten;
+    }
+    return true;
+}
+
+// Sends the first len bytes of the file from to fd, without going through
+// this process when the kernel can do it.
+bool send_data(int from, int fd, size_t len) {
+    off_t offset = 0;
+#ifdef COTTON_LINUX
+    while ((size_t)offset < len) {
+        ssize_t sent = sendfile(fd, from, &offset, len - offset);
+        if (sent == -1 && errno == EAGAIN) {
+            struct pollfd pfd = {fd, POLLOUT, 0};
+            poll(&pfd, 1, -1);
+            continue;
+        }
+        if (sent == -1 && errno == EINTR) continue;
+        if (sent == -1 && offset == 0 && (errno == EINVAL || errno == ENOSYS)) break;
+        if (sent == -1) return false;
+        if (sent == 0) {
+            errno = EAGAIN; // Truncated in the meantime
+            return false;
+        }
+    }
+#endif
+    char buf[pipe_chunk];
+    while ((size_t)offset < len) {
+        ssize_t nread = pread(from, buf, std::min(sizeof buf, len - offset), offset);
+        if (nread == -1 && errno == EINTR) continue;
+        if (nread == -1) return false;
+        if (nread == 0) {
+            errno = EAGAIN;
+            return false;
+        }
+        if (!write_out(fd, buf, nread)) return false;
+        offset += nread;
+    }
+    return true;
+}
+}
+
+bool DummyUnixSandbox::inherit_streams = true;
 
 DummyUnixSandbox::BoxLocker::BoxLocker(const DummyUnixSandbox* box, const std::string& lock): box(box) {
     lock_name = box->get_root() + "../" + lock;
-    if (open(lock_name.c_str(), O_RDWR | O_CREAT | O_EXCL, DummyUnixSandbox::file_mode) == -1) {
-        box->error(4, serror("Error acquiring lock " + lock_name));
-        has_lock_ = false;
-    } else {
-        has_lock_ = true;
+    has_lock_ = BoxIndex::create_lock(lock_name, DummyUnixSandbox::file_mode);
+    int err = errno;
+    if (!has_lock_ && err == EEXIST && BoxIndex::is_stale_lock(lock_name)) {
+        // The lock was left behind by a dead process. Hold the index lock
+        // while taking it over, so that only one process does it.
+        BoxIndex index(box->base_path);
+        if (BoxIndex::is_stale_lock(lock_name)) unlink(lock_name.c_str());
+        has_lock_ = BoxIndex::create_lock(lock_name, DummyUnixSandbox::file_mode);
+        err = errno;
     }
+    if (!has_lock_) box->error(4, serror("Error acquiring lock " + lock_name, err));
 }
 
 DummyUnixSandbox::BoxLocker::~BoxLocker() {
@@ -31,20 +132,72 @@ bool DummyUnixSandbox::send_error(int error_id, int err) {
     return 2*sizeof(int) == write(comm[1], (void*)tmp, 2*sizeof(int));
 }
 
-int DummyUnixSandbox::get_error(int& error_id, int& err) {
-    union {int i[2]; char c[2*sizeof(int)];} tmp;
-    unsigned buff_fill = 0;
-    while (buff_fill < 2*sizeof(int)) {
-        int nread = read(comm[0], tmp.c+buff_fill, 2*sizeof(int)-buff_fill);
-        if (nread == -1 && errno == EINTR) continue;
-        if (nread <= 0) return nread;
-        buff_fill += nread;
+int DummyUnixSandbox::get_error(int& error_id, int& err, std::vector<int>* fds) {
+    int tmp[2];
+    int received[8];
+    size_t count = 8;
+    errno = 0;
+    bool ok = receive_fds(comm[0], tmp, sizeof tmp, received, count);
+    for (size_t i=0; i<count; i++) {
+        if (ok && fds != nullptr) fds->push_back(received[i]);
+        else close(received[i]);
     }
-    error_id = tmp.i[0];
-    err = tmp.i[1];
+    if (!ok) return errno ? -1 : 0;
+    error_id = tmp[0];
+    err = tmp[1];
     return 1;
 }
 
+bool DummyUnixSandbox::start_perf_counters() {
+#ifdef COTTON_LINUX
+    int fds[PerfCounters::counter_count];
+    if (!PerfCounters::open(instruction_limit, fds)) {
+        // Without a limit to enforce, the program can run uncounted.
+        send_error(instruction_limit ? 6 : -7, errno);
+        return instruction_limit == 0;
+    }
+    // Only the counters that could be opened are sent, err tells which.
+    int sent[PerfCounters::counter_count];
+    size_t count = 0;
+    int opened = 0;
+    for (int i=0; i<PerfCounters::counter_count; i++) {
+        if (fds[i] == -1) continue;
+        sent[count++] = fds[i];
+        opened |= 1 << i;
+    }
+    int msg[2] = {perf_counters_opened, opened};
+    bool ok = send_fds(comm[1], msg, sizeof msg, sent, count);
+    for (size_t i=0; i<count; i++) close(sent[i]);
+    if (!ok || instruction_limit == 0) return ok;
+    // The parent must be watching the overflows before they can happen.
+    char ack;
+    return read_all(comm[1], &ack, 1);
+#else
+    return true;
+#endif
+}
+
+bool DummyUnixSandbox::attach_perf_counters(int opened, const std::vector<int>& fds) {
+#ifdef COTTON_LINUX
+    int counters[PerfCounters::counter_count];
+    size_t next = 0;
+    for (int i=0; i<PerfCounters::counter_count; i++)
+        counters[i] = (opened & (1 << i)) && next < fds.size() ? fds[next++] : -1;
+    if (counters[PerfCounters::instructions] == -1 || !perf.attach(counters, instruction_limit > 0)) {
+        error(5, serror("Error watching the instruction limit"));
+        return false;
+    }
+    char ack = 0;
+    if (instruction_limit > 0 && !send_all(comm[0], &ack, 1)) {
+        error(5, serror("Error starting the performance counters"));
+        return false;
+    }
+    return true;
+#else
+    return false;
+#endif
+}
+
 std::string DummyUnixSandbox::err_string(int error_id) const {
     switch (error_id) {
         case -1: return "Error setting stack limit";
@@ -52,20 +205,53 @@ std::string DummyUnixSandbox::err_string(int error_id) const {
         case -3: return "Error setting time limit";
         case -4: return "Error setting process limit";
         case -5: return "Error setting disk limit";
+        case -6: return "Error setting the cpu affinity";
+        case -7: return "Performance counters not available";
         case 1: return "Cannot open stdin file";
         case 2: return "Cannot open stdout file";
         case 3: return "Cannot open stderr file";
         case 4: return "execv failed";
         case 5: return "chdir failed";
+        case 6: return "Error opening the performance counters";
         default: return "Unknown error";
     }
 }
 
+DummyUnixSandbox::~DummyUnixSandbox() {
+    close_streams();
+    for (int fd: memfds)
+        if (fd != -1) close(fd);
+}
+
 bool DummyUnixSandbox::prepare_io_redirect(const std::string& file, std::string& redir, mode_t mode) {
     if (file == "") {
         redir = file;
         return true;
     }
+    if (file == "memfd") {
+#ifdef COTTON_LINUX
+        if (!(mode & O_CREAT)) {
+            error(2, "Only the output can be kept in a memfd");
+            return false;
+        }
+        redir = file;
+        return true;
+#else
+        error(254, "This sandbox cannot keep the output in memory!");
+        return false;
+#endif
+    }
+    if (is_fd_redirect(file)) {
+        char* end;
+        long fd = strtol(file.c_str() + 3, &end, 10);
+        if (file.size() == 3 || *end != 0 || fd < 0 || fd > std::numeric_limits<int>::max() ||
+            fcntl(fd, F_GETFD) == -1) {
+            error(2, "Invalid file descriptor in " + file);
+            return false;
+        }
+        redir = file;
+        return true;
+    }
     int fd = open((get_root() + file).c_str(), mode, file_mode);
     if (fd == -1) error(4, serror("Cannot open file " + file));
     else {
@@ -75,50 +261,164 @@ bool DummyUnixSandbox::prepare_io_redirect(const std::string& file, std::string&
     return fd != -1;
 }
 
-bool DummyUnixSandbox::setup_io_redirect(const std::string& file, int dest_fd, mode_t mode) {
-    if (file == "") return true;
-    int src_fd = open((get_root() + file).c_str(), mode);
-    if (src_fd == -1) {
-        send_error(1, errno);
-        return false;
+bool DummyUnixSandbox::open_streams() {
+    const std::string* files[3] = {&stdin_, &stdout_, &stderr_};
+    for (int i=0; i<3; i++) {
+        Stream& stream = streams[i];
+        if (!gets_stream_from_parent(i)) continue;
+        bool checked = i == 1 && !expected_output.empty();
+        if (checked) {
+            OutputChecker::Mode mode;
+            OutputChecker::parse_mode(check_mode, mode);
+            checker.reset(new OutputChecker());
+            if (!checker->open(expected_output, mode, check_tolerance)) {
+                error(4, serror("Cannot read the expected output " + expected_output));
+                return false;
+            }
+        }
+        if (!is_fd_redirect(*files[i])) {
+            // A checked output, that may still go to a file of the box.
+            if (*files[i] != "") {
+                stream.dest = open((get_root() + *files[i]).c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, file_mode);
+                if (stream.dest == -1) {
+                    error(4, serror("Cannot open file " + *files[i]));
+                    return false;
+                }
+                stream.owns_dest = true;
+            }
+        } else if (*files[i] == "memfd") {
+#ifdef COTTON_LINUX
+            if (memfds[i] != -1) close(memfds[i]);
+            memfds[i] = memfd_create(i == 1 ? "cotton-stdout" : "cotton-stderr", MFD_CLOEXEC);
+            if (memfds[i] == -1) {
+                error(4, serror("Error creating a memfd"));
+                return false;
+            }
+            stream.dest = memfds[i];
+#endif
+        } else {
+            stream.dest = atoi(files[i]->c_str() + 3);
+            if (fcntl(stream.dest, F_GETFD) == -1) {
+                stream.dest = -1;
+                error(4, serror("Cannot redirect to " + *files[i]));
+                return false;
+            }
+        }
+        stream.child = stream.dest;
+        if (i == 0 || (output_limit.bytes() == 0 && !checked)) continue;
+        int fds[2];
+        if (pipe(fds) == -1) {
+            error(4, serror("Error creating a pipe for the output"));
+            return false;
+        }
+        fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+        fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+        fcntl(fds[0], F_SETFL, O_NONBLOCK);
+        stream.pipe = fds[0];
+        stream.child = fds[1];
+        stream.written = 0;
     }
-    dup2(src_fd, dest_fd);
     return true;
 }
 
+void DummyUnixSandbox::close_streams() {
+    for (auto& stream: streams) {
+        if (stream.pipe != -1) {
+            close(stream.pipe);
+            if (stream.child != -1) close(stream.child);
+        }
+        if (stream.owns_dest) close(stream.dest);
+        stream = Stream();
+    }
+    checker.reset();
+}
 
-[[noreturn]] void DummyUnixSandbox::box_inner(const std::string& command, const std::vector<std::string>& args) {
-    // Set up IO redirection.
-    if (!setup_io_redirect(stdin_, fileno(stdin), O_RDONLY)) exit(1);
-    if (!setup_io_redirect(stdout_, fileno(stdout), O_RDWR)) exit(1);
-    if (!setup_io_redirect(stderr_, fileno(stderr), O_RDWR)) exit(1);
-
-    // Make the pipe close on the call to exec()
-    fcntl(comm[1], F_SETFD, FD_CLOEXEC);
+bool DummyUnixSandbox::drain_stream(Stream& stream, std::string& kill_reason) {
+    bool checked = &stream == &streams[1] && checker;
+    size_t limit = output_limit.bytes() ? output_limit.bytes() : std::numeric_limits<size_t>::max();
+    // A file of the box is written by this process, which has no RLIMIT_FSIZE.
+    size_t disk = stream.owns_dest && disk_limit.bytes() ? disk_limit.bytes() : std::numeric_limits<size_t>::max();
+    char buf[pipe_chunk];
+    while (stream.pipe != -1) {
+        size_t room = std::min(limit, disk) - stream.written;
+        ssize_t n;
+        if (room == 0) {
+            // Anything more is over the limit.
+            char c;
+            n = read(stream.pipe, &c, 1);
+            if (n > 0) {
+                kill_reason = stream.written >= limit ? "Output limit exceeded" : "Disk limit exceeded";
+                return false;
+            }
+        } else if (checked) {
+            n = read(stream.pipe, buf, std::min(room, pipe_chunk));
+            if (n > 0 && !checker->feed(buf, n)) {
+                kill_reason = "Wrong output";
+                return false;
+            }
+            if (n > 0 && stream.dest != -1 && !write_all(stream.dest, buf, n)) n = -1;
+        } else {
+            n = move_data(stream.pipe, stream.dest, room);
+        }
+        if (n == -1 && errno == EINTR) continue;
+        if (n == -1 && errno == EAGAIN) return true;
+        if (n <= 0) {
+            // Nothing more can be written: the writer died or the destination
+            // does not accept data anymore.
+            close(stream.pipe);
+            stream.pipe = -1;
+            return true;
+        }
+        stream.written += n;
+    }
+    return true;
+}
 
-    // Build arguments for execve
-    int trailing_slash_count = 0;
-    while (command[trailing_slash_count] == '/') trailing_slash_count++;
-    std::string executable = command.substr(trailing_slash_count);
-    std::vector<char*> e_args;
-    char* executable_c_str = new char[executable.size()+1];
-    strcpy(executable_c_str, executable.c_str());
-    e_args.push_back(executable_c_str);
+bool DummyUnixSandbox::set_output_check(const std::string& expected_path, const std::string& mode,
+    double tolerance) {
+    OutputChecker::Mode parsed;
+    if (!OutputChecker::parse_mode(mode, parsed)) {
+        error(2, "Unknown output check mode " + mode);
+        return false;
+    }
+    if (!expected_path.empty() && access(expected_path.c_str(), R_OK) == -1) {
+        error(4, serror("Cannot read the expected output " + expected_path));
+        return false;
+    }
+    expected_output = expected_path;
+    check_mode = mode;
+    check_tolerance = tolerance;
+    return true;
+}
 
-    for (auto arg: args) {
-        char* tmp = new char[arg.size()+1];
-        strcpy(tmp, arg.c_str());
-        e_args.push_back(tmp);
+int DummyUnixSandbox::get_output_fd(const std::string& stream) const {
+    int i = stream == "stdout" ? 1 : stream == "stderr" ? 2 : 0;
+    if (i == 0) {
+        error(2, "Invalid output stream " + stream);
+        return -1;
     }
-    e_args.push_back(nullptr);
+    if (memfds[i] == -1) error(2, "This process has no memfd with the " + stream + " of the last run");
+    return memfds[i];
+}
 
-    // Change directory to box_root
-    if (chdir(get_root().c_str()) != 0) {
-        send_error(5, errno);
-        exit(1);
+bool DummyUnixSandbox::setup_io_redirect(const std::string& file, int stream_fd, int dest_fd, mode_t mode) {
+    if (stream_fd != -1) {
+        dup2(stream_fd, dest_fd);
+        return true;
     }
+    if (file == "" && inherit_streams) return true;
+    std::string path = file == "" ? "/dev/null" : get_root() + file;
+    int src_fd = open(path.c_str(), mode);
+    if (src_fd == -1) {
+        send_error(1, errno);
+        return false;
+    }
+    dup2(src_fd, dest_fd);
+    return true;
+}
+
 
-    // Set up limits
+void DummyUnixSandbox::set_limits() {
     struct rlimit rlim;
     rlim.rlim_cur = rlim.rlim_max = RLIM_INFINITY;
     if (setrlimit(RLIMIT_STACK, &rlim) == -1) send_error(-1, errno);
@@ -126,8 +426,9 @@ bool DummyUnixSandbox::setup_io_redirect(const std::string& file, int dest_fd, m
         rlim.rlim_cur = rlim.rlim_max = mem_limit.bytes();
         if (setrlimit(RLIMIT_AS, &rlim) == -1) send_error(-2, errno);
     }
-    if (time_limit.seconds() != 0) {
-        rlim.rlim_cur = rlim.rlim_max = time_limit.seconds();
+    if (time_limit.microseconds() != 0) {
+        // The exact limit is enforced by the parent, this is just a safety net.
+        rlim.rlim_cur = rlim.rlim_max = time_limit.seconds() + 1;
         if (setrlimit(RLIMIT_CPU, &rlim) == -1) send_error(-3, errno);
     }
     if (process_limit) {
@@ -137,98 +438,408 @@ bool DummyUnixSandbox::setup_io_redirect(const std::string& file, int dest_fd, m
     if (disk_limit.bytes()) {
         rlim.rlim_cur = rlim.rlim_max = disk_limit.bytes();
         if (setrlimit(RLIMIT_FSIZE, &rlim) == -1) send_error(-5, errno);
-        rlim.rlim_cur = rlim.rlim_max = 0;
-        if (setrlimit(RLIMIT_NOFILE, &rlim) == -1) send_error(-5, errno);
     }
-    if (!pre_exec_hook()) exit(1);
+#ifdef COTTON_LINUX
+    if (cpu != -1) {
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(cpu, &cpus);
+        if (sched_setaffinity(0, sizeof cpus, &cpus) == -1) send_error(-6, errno);
+    }
+#endif
+}
+
+void DummyUnixSandbox::prepare_exec_args(const std::string& command, const std::vector<std::string>& args) {
+    size_t trailing_slash_count = 0;
+    while (command[trailing_slash_count] == '/') trailing_slash_count++;
+    exec_args.clear();
+    exec_args.push_back(const_cast<char*>(command.c_str() + trailing_slash_count));
+    for (const auto& arg: args) exec_args.push_back(const_cast<char*>(arg.c_str()));
+    exec_args.push_back(nullptr);
+}
+
+[[noreturn]] void DummyUnixSandbox::box_inner(const std::string& command, const std::vector<std::string>& args) {
+    // Set up IO redirection.
+    trace::begin("io_redirect");
+    // Move the streams from the parent out of the way of the standard ones.
+    for (auto& stream: streams)
+        if (stream.child != -1 && stream.child <= 2) stream.child = fcntl(stream.child, F_DUPFD_CLOEXEC, 3);
+    if (!setup_io_redirect(stdin_, streams[0].child, fileno(stdin), O_RDONLY)) _exit(1);
+    if (!setup_io_redirect(stdout_, streams[1].child, fileno(stdout), O_RDWR)) _exit(1);
+    if (!setup_io_redirect(stderr_, streams[2].child, fileno(stderr), O_RDWR)) _exit(1);
+    trace::end("io_redirect");
+
+    // Make the pipe close on the call to exec()
+    fcntl(comm[1], F_SETFD, FD_CLOEXEC);
+
+    // Built by run_locked, or here in the children of a zygote.
+    if (exec_args.empty()) prepare_exec_args(command, args);
+
+    // Change directory to box_root
+    if (chdir(get_root().c_str()) != 0) {
+        send_error(5, errno);
+        _exit(1);
+    }
+
+    trace::begin("set_limits");
+    set_limits();
+    trace::end("set_limits");
+    trace::begin("pre_exec_hook");
+    if (!pre_exec_hook()) _exit(1);
+    trace::end("pre_exec_hook");
     // Set all privileges to the effective user id
     // ie. drop privileges if the program is setuid, do nothing otherwise
     setreuid(geteuid(), getuid());
     setuid(getuid());
-    execv(executable.c_str(), &e_args[0]);
+    if (use_perf_counters && !start_perf_counters()) _exit(1);
+    if (!pre_execv_hook()) _exit(1);
+    // Once the counters and the hooks opened their descriptors, since none can
+    // be created after it.
+    if (disk_limit.bytes()) {
+        struct rlimit rlim = {0, 0};
+        if (setrlimit(RLIMIT_NOFILE, &rlim) == -1) send_error(-5, errno);
+    }
+    // Ended by the parent, when it sees that the exec succeeded.
+    trace::begin("execv");
+    execv(exec_args[0], exec_args.data());
     send_error(4, errno);
-    exit(1);
+    _exit(1);
 }
 
 bool DummyUnixSandbox::box_checker(pid_t box_pid) {
     int error_id = 0;
     int err_msg = 0;
     int err_ret;
-    bool timed_out = false;
-    while ((err_ret = get_error(error_id, err_msg)) != 0) {
+    std::string kill_reason;
+    // Forget about the previous run, in case this one fails.
+    memory_usage = 0;
+    running_time = 0;
+    wall_time = 0;
+    exit_status = "";
+    return_code = 0;
+    signal = 0;
+    run_cpu = -1;
+    instruction_count = 0;
+    cycle_count = 0;
+    task_clock = 0;
+    verdict = "";
+    std::vector<int> fds;
+    while ((err_ret = get_error(error_id, err_msg, &fds)) != 0) {
         if (err_ret == -1) {
             error(5, serror("Error getting errors"));
             return false;
         }
+        if (error_id == perf_counters_opened) {
+            bool attached = attach_perf_counters(err_msg, fds);
+            fds.clear();
+            if (attached) continue;
+            kill(box_pid, SIGKILL);
+            while (waitpid(box_pid, nullptr, 0) == -1 && errno == EINTR);
+            return false;
+        }
+        if (error_id >= subclass_message) {
+            bool handled = child_message_hook(error_id, err_msg, fds, kill_reason);
+            fds.clear();
+            if (handled) continue;
+            kill(box_pid, SIGKILL);
+            if (!kill_reason.empty()) continue; // The run ends with kill_reason
+            while (waitpid(box_pid, nullptr, 0) == -1 && errno == EINTR);
+            return false;
+        }
         if (error_id < 0) {
             warning(5, serror(err_string(error_id), err_msg));
         } else {
             error(5, serror(err_string(error_id), err_msg));
+            // The child exits by itself after reporting an error.
+            while (waitpid(box_pid, nullptr, 0) == -1 && errno == EINTR);
             return false;
         }
     }
     // If we arrive here, exec() was successfully executed in the child.
-    auto start = std::chrono::high_resolution_clock::now();
+    trace::end("execv");
+    auto start = exec_unobserved ? fork_time : std::chrono::steady_clock::now();
     int ret = 0;
-    if (wall_time_limit.microseconds() > 0) {
-        auto now = std::chrono::high_resolution_clock::now();
-        size_t micros = std::chrono::duration_cast<std::chrono::microseconds>(now-start).count();
-        bool waited = false;
-        while (micros < wall_time_limit.microseconds()) {
-            std::this_thread::sleep_for(std::chrono::milliseconds(1));
-            int what = waitpid(box_pid, &ret, WNOHANG);
-            if (what > 0) {
-                waited = true;
-                break;
-            }
-            now = std::chrono::high_resolution_clock::now();
-            micros = std::chrono::duration_cast<std::chrono::microseconds>(now-start).count();
-        }
-        if (!waited) {
-            timed_out = true;
-            kill(box_pid, SIGKILL);
-            waitpid(box_pid, &ret, 0);
-        }
-    } else {
-        waitpid(box_pid, &ret, 0);
+    struct rusage stats;
+    trace::begin("wait");
+    if (!wait_box(box_pid, start, ret, stats, kill_reason)) return false;
+    for (int i=1; i<3; i++) {
+        std::string reason;
+        if (!drain_stream(streams[i], reason) && kill_reason.empty()) kill_reason = reason;
+    }
+    if (checker) {
+        verdict = checker->finish() ? "Correct" : "Wrong answer: " + checker->mismatch();
+        checker.reset();
     }
+    trace::end("wait");
     // The child has exited, collect statistics
-    auto now = std::chrono::high_resolution_clock::now();
+    auto now = std::chrono::steady_clock::now();
     return_code = WIFEXITED(ret) ? WEXITSTATUS(ret) : 0;
     signal = WIFSIGNALED(ret) ? WTERMSIG(ret) : 0;
-    if (timed_out) exit_status = "Timed out";
-    else exit_status = WIFSIGNALED(ret) ? "Signaled" : "Terminated normally";
     wall_time = now-start;
-    struct rusage stats;
-    getrusage(RUSAGE_CHILDREN, &stats);
     memory_usage = space_limit_t::from_rusage_unit(stats.ru_maxrss);
     running_time = stats.ru_utime;
     running_time += stats.ru_stime;
+#ifdef COTTON_LINUX
+    if (perf.is_attached()) {
+        instruction_count = perf.get(PerfCounters::instructions);
+        cycle_count = perf.get(PerfCounters::cycles);
+        task_clock = time_limit_t::from_microseconds(perf.get(PerfCounters::task_clock) / 1000);
+    }
+#endif
+    if (kill_reason != "") exit_status = kill_reason;
+    else if (time_limit.microseconds() > 0 && running_time.microseconds() > time_limit.microseconds())
+        exit_status = "CPU time exceeded";
+    else if (instruction_limit > 0 && instruction_count >= instruction_limit)
+        exit_status = "Instruction limit exceeded";
+    else exit_status = WIFSIGNALED(ret) ? "Signaled" : "Terminated normally";
+    run_cpu = cpu;
+    return true;
+}
+
+bool DummyUnixSandbox::set_cpu(int cpu) {
+#ifdef COTTON_LINUX
+    if (cpu < -1 || cpu >= CPU_SETSIZE) {
+        error(2, "Invalid cpu " + std::to_string(cpu));
+        return false;
+    }
+    this->cpu = cpu;
+    return true;
+#else
+    error(254, "This method is not implemented by this sandbox!");
+    return false;
+#endif
+}
+
+bool DummyUnixSandbox::set_perf_counters(bool enabled) {
+#ifdef COTTON_LINUX
+    if (enabled && !PerfCounters::is_available()) {
+        error(2, "Performance counters are not available: " + PerfCounters::unavailable_reason());
+        return false;
+    }
+    use_perf_counters = enabled;
+    if (!enabled) instruction_limit = 0;
+    return true;
+#else
+    error(254, "This method is not implemented by this sandbox!");
+    return false;
+#endif
+}
+
+bool DummyUnixSandbox::set_instruction_limit(uint64_t limit) {
+    if (limit > 0 && !set_perf_counters(true)) return false;
+    instruction_limit = limit;
+    return true;
+}
+
+RunResult DummyUnixSandbox::get_run_result() const {
+    RunResult res;
+    // The statistics are reset when a run fails.
+    res.success = !exit_status.empty();
+    res.status = exit_status;
+    res.return_code = return_code;
+    res.signal = signal;
+    res.running_time = running_time;
+    res.wall_time = wall_time;
+    res.memory_usage = memory_usage;
+    res.cpu = run_cpu;
+    res.instructions = instruction_count;
+    res.cycles = cycle_count;
+    res.task_clock = task_clock;
+    res.verdict = verdict;
+    return res;
+}
+
+bool DummyUnixSandbox::sample_running_time(pid_t box_pid, time_limit_t& used) const {
+    clockid_t clock;
+    struct timespec ts;
+    if (clock_getcpuclockid(box_pid, &clock) != 0 || clock_gettime(clock, &ts) == -1) return false;
+    used = time_limit_t::from_microseconds(ts.tv_sec*1'000'000ULL + ts.tv_nsec/1000);
+    return true;
+}
+
+size_t DummyUnixSandbox::cpu_parallelism() const {
+    // RLIMIT_NPROC also prevents the creation of threads.
+    if (process_limit) return 1;
+    return std::max(std::thread::hardware_concurrency(), 1U);
+}
+
+bool DummyUnixSandbox::wait_box(pid_t box_pid, std::chrono::steady_clock::time_point start, int& status,
+    struct rusage& usage, std::string& kill_reason) {
+    bool has_wall_limit = wall_time_limit.microseconds() > 0;
+    bool has_cpu_limit = time_limit.microseconds() > 0;
+#ifdef COTTON_LINUX
+    int overflow_fd = perf.overflow_fd();
+#else
+    int overflow_fd = -1;
+#endif
+    bool has_output_pipes = streams[1].pipe != -1 || streams[2].pipe != -1;
+    if (!has_wall_limit && !has_cpu_limit && overflow_fd == -1 && !has_output_pipes && cancel_fd == -1 &&
+        watched_fd() == -1) {
+        while (wait4(box_pid, &status, 0, &usage) == -1) {
+            if (errno == EINTR) continue;
+            error(5, serror("wait4"));
+            return false;
+        }
+        return true;
+    }
+#ifdef COTTON_LINUX
+    // Sleep until either the child exits, the deadline expires or it is time
+    // to check the cpu time again.
+    int pidfd = open_pidfd(box_pid);
+    if (pidfd == -1) return poll_wait_box(box_pid, start, status, usage, kill_reason);
+    int wall_timer = has_wall_limit ? timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC) : -1;
+    int cpu_timer = has_cpu_limit ? timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC) : -1;
+    if ((has_wall_limit && wall_timer == -1) || (has_cpu_limit && cpu_timer == -1)) {
+        close(pidfd);
+        if (wall_timer != -1) close(wall_timer);
+        if (cpu_timer != -1) close(cpu_timer);
+        return poll_wait_box(box_pid, start, status, usage, kill_reason);
+    }
+    if (has_wall_limit) {
+        auto deadline = start.time_since_epoch() + std::chrono::microseconds(wall_time_limit.microseconds());
+        auto deadline_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(deadline).count();
+        struct itimerspec timer_value = {};
+        timer_value.it_value.tv_sec = deadline_ns / 1'000'000'000;
+        timer_value.it_value.tv_nsec = deadline_ns % 1'000'000'000;
+        timerfd_settime(wall_timer, TFD_TIMER_ABSTIME, &timer_value, nullptr);
+    }
+    struct pollfd fds[8] = {{pidfd, POLLIN, 0}, {wall_timer, POLLIN, 0}, {cpu_timer, POLLIN, 0},
+        {overflow_fd, POLLIN, 0}, {streams[1].pipe, POLLIN, 0}, {streams[2].pipe, POLLIN, 0},
+        {cancel_fd, POLLIN, 0}, {watched_fd(), POLLIN, 0}};
+    while (true) {
+        if (has_cpu_limit) {
+            time_limit_t used;
+            if (!sample_running_time(box_pid, used)) break; // The child is already gone
+            if (used.microseconds() >= time_limit.microseconds()) {
+                kill_reason = "CPU time exceeded";
+                kill(box_pid, SIGKILL);
+                break;
+            }
+            // The cpu time cannot grow faster than this, so no check is needed
+            // before the remaining time elapses.
+            size_t wait_us = (time_limit.microseconds() - used.microseconds()) / cpu_parallelism();
+            wait_us = std::max(wait_us, cpu_check_min_interval);
+            struct itimerspec timer_value = {};
+            timer_value.it_value.tv_sec = wait_us / 1'000'000;
+            timer_value.it_value.tv_nsec = wait_us % 1'000'000 * 1000;
+            timerfd_settime(cpu_timer, 0, &timer_value, nullptr);
+        }
+        fds[4].fd = streams[1].pipe;
+        fds[5].fd = streams[2].pipe;
+        if (poll(fds, 8, -1) == -1) {
+            if (errno == EINTR) continue;
+            error(5, serror("poll"));
+            kill(box_pid, SIGKILL);
+            break;
+        }
+        if (fds[0].revents & POLLIN) break;
+        if (fds[1].revents & POLLIN) {
+            kill_reason = "Timed out";
+            kill(box_pid, SIGKILL);
+            break;
+        }
+        if (fds[3].revents & POLLIN) {
+            kill_reason = "Instruction limit exceeded";
+            kill(box_pid, SIGKILL);
+            break;
+        }
+        if (fds[6].revents & (POLLIN | POLLHUP)) {
+            kill_reason = "Cancelled";
+            kill(box_pid, SIGKILL);
+            break;
+        }
+        if ((fds[7].revents & POLLIN) && !watched_fd_hook(kill_reason)) {
+            kill(box_pid, SIGKILL);
+            break;
+        }
+        if (((fds[4].revents | fds[5].revents) & (POLLIN | POLLHUP)) &&
+            (!drain_stream(streams[1], kill_reason) || !drain_stream(streams[2], kill_reason))) {
+            kill(box_pid, SIGKILL);
+            break;
+        }
+        uint64_t expirations;
+        if (fds[2].revents & POLLIN) read(cpu_timer, &expirations, sizeof expirations);
+    }
+    if (cpu_timer != -1) close(cpu_timer);
+    if (wall_timer != -1) close(wall_timer);
+    close(pidfd);
+    while (wait4(box_pid, &status, 0, &usage) == -1) {
+        if (errno == EINTR) continue;
+        error(5, serror("wait4"));
+        return false;
+    }
+    return true;
+#else
+    return poll_wait_box(box_pid, start, status, usage, kill_reason);
+#endif
+}
+
+// Fallback for systems without pidfds: check on the child every millisecond.
+bool DummyUnixSandbox::poll_wait_box(pid_t box_pid, std::chrono::steady_clock::time_point start, int& status,
+    struct rusage& usage, std::string& kill_reason) {
+    while (true) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        int what = wait4(box_pid, &status, WNOHANG, &usage);
+        if (what > 0) return true;
+        if (!drain_stream(streams[1], kill_reason) || !drain_stream(streams[2], kill_reason)) break;
+        struct pollfd cancel = {cancel_fd, POLLIN, 0};
+        if (cancel_fd != -1 && poll(&cancel, 1, 0) > 0) {
+            kill_reason = "Cancelled";
+            break;
+        }
+        struct pollfd watched = {watched_fd(), POLLIN, 0};
+        if (watched.fd != -1 && poll(&watched, 1, 0) > 0 && (watched.revents & POLLIN) &&
+            !watched_fd_hook(kill_reason)) break;
+        auto now = std::chrono::steady_clock::now();
+        size_t micros = std::chrono::duration_cast<std::chrono::microseconds>(now-start).count();
+        if (wall_time_limit.microseconds() > 0 && micros >= wall_time_limit.microseconds()) {
+            kill_reason = "Timed out";
+            break;
+        }
+        time_limit_t used;
+        if (time_limit.microseconds() > 0 && sample_running_time(box_pid, used) &&
+            used.microseconds() >= time_limit.microseconds()) {
+            kill_reason = "CPU time exceeded";
+            break;
+        }
+#ifdef COTTON_LINUX
+        if (instruction_limit > 0 && perf.is_attached() &&
+            perf.get(PerfCounters::instructions) >= instruction_limit) {
+            kill_reason = "Instruction limit exceeded";
+            break;
+        }
+#endif
+    }
+    kill(box_pid, SIGKILL);
+    while (wait4(box_pid, &status, 0, &usage) == -1 && errno == EINTR);
     return true;
 }
 
 size_t DummyUnixSandbox::create_box(size_t box_limit) {
-    //TODO: fix this for the many weird things that could possibly happen
-    for (size_t box_id = 1; box_id < box_limit; box_id++) {
+    BoxIndex index(base_path);
+    if (!index.is_open()) {
+        error(4, serror("Error opening the box index in " + base_path));
+        return 0;
+    }
+    size_t box_id;
+    while ((box_id = index.allocate(box_limit)) != 0) {
         std::string current_attempt = box_base_path(base_path, box_id);
         if (mkdir(current_attempt.c_str(), box_mode) == -1 && errno != EEXIST) {
+            index.release(box_id);
             error(4, serror("Error creating sandbox " + current_attempt));
             return 0;
         }
-
-        struct stat statbuf;
-        stat(current_attempt.c_str(), &statbuf);
-        if (!S_ISDIR(statbuf.st_mode)) continue;
-
         current_attempt += "lock";
-        int res = open(current_attempt.c_str(), O_RDWR | O_CREAT | O_EXCL, file_mode);
-        if (res == -1 && errno == EEXIST) continue;
-        if (res == -1) {
-            warning(4, serror("Something weird happened creating sandbox " + current_attempt));
-            continue;
+        if (!BoxIndex::create_lock(current_attempt, file_mode)) {
+            // Taken by someone who does not use the index, or not a directory:
+            // leave the id marked as used.
+            if (errno == EEXIST || errno == ENOTDIR) continue;
+            index.release(box_id);
+            error(4, serror("Error creating sandbox " + current_attempt));
+            return 0;
         }
         current_attempt = box_base_path(base_path, box_id) + "file_root/";
-        int err = rm_rf(current_attempt);
+        int err = rm_rf_async(current_attempt, trash_path());
         if (err && err != ENOENT) {
             error(4, serror("Error deleting old file_root " + current_attempt, err));
             return 0;
@@ -244,39 +855,301 @@ size_t DummyUnixSandbox::create_box(size_t box_limit) {
     return 0;
 }
 
+[[noreturn]] void DummyUnixSandbox::child_main(const std::string& command, const std::vector<std::string>& args) {
+    if (comm[0] != -1) close(comm[0]);
+    trace::begin("post_fork_hook");
+    if (!post_fork_hook()) _exit(1);
+    trace::end("post_fork_hook");
+    box_inner(command, args);
+    _exit(1);
+}
+
+pid_t DummyUnixSandbox::fork_box(const std::string& command, const std::vector<std::string>& args) {
+    pid_t box_pid = fork();
+    if (box_pid == 0) child_main(command, args);
+    if (box_pid == -1) error(4, serror("fork"));
+    return box_pid;
+}
+
 bool DummyUnixSandbox::run(const std::string& command, const std::vector<std::string>& args) {
+    trace::Phase phase("lock");
     BoxLocker locker(this, "run_lock");
     if (!locker.has_lock()) return false;
-    if (!pre_fork_hook()) return false;
-    pid_t box_pid;
-    int ret = pipe(comm);
-    if (ret == -1) {
-        error(4, serror("Error opening pipe to child process"));
+    phase.end();
+    return run_locked(command, args);
+}
+
+std::vector<RunResult> DummyUnixSandbox::run_many(const std::string& command, const std::vector<std::string>& args,
+    const std::vector<std::pair<std::string, std::string>>& cases) {
+    std::vector<RunResult> results;
+    BoxLocker locker(this, "run_lock");
+    if (!locker.has_lock()) return results;
+    std::string saved_stdin = stdin_;
+    std::string saved_stdout = stdout_;
+    for (const auto& io: cases) {
+        RunResult res;
+        if (redirect_stdin(io.first) && redirect_stdout(io.second) && run_locked(command, args))
+            res = get_run_result();
+        results.push_back(res);
+    }
+    stdin_ = saved_stdin;
+    stdout_ = saved_stdout;
+    return results;
+}
+
+bool DummyUnixSandbox::run_locked(const std::string& command, const std::vector<std::string>& args) {
+    if (!open_streams()) {
+        close_streams();
         return false;
     }
-    if ((box_pid = fork()) != 0) {
-        if (box_pid == -1) {
-            error(4, serror("fork"));
+    {
+        trace::Phase phase("pre_fork_hook");
+        if (!pre_fork_hook()) {
+            close_streams();
             return false;
         }
-        close(comm[1]);
-        bool ret = box_checker(box_pid);
-        if (!cleanup_hook()) return false;
-        return ret;
-    } else {
+    }
+    // A socket, so that the child can also pass file descriptors.
+    int ret = socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, comm);
+    if (ret == -1) {
+        error(4, serror("Error opening socket to child process"));
+        close_streams();
+        return false;
+    }
+    trace::begin("fork");
+    fork_time = std::chrono::steady_clock::now();
+    exec_unobserved = false;
+    prepare_exec_args(command, args);
+    pid_t box_pid = fork_box(command, args);
+    exec_args.clear();
+    trace::end("fork");
+    close(comm[1]);
+    // Only the child writes to the output pipes, so that they get closed when
+    // it exits.
+    for (auto& stream: streams) {
+        if (stream.pipe == -1) continue;
+        close(stream.child);
+        stream.child = -1;
+    }
+    if (box_pid == -1) {
         close(comm[0]);
-        if (!post_fork_hook()) exit(1);
-        box_inner(command, args);
+        close_streams();
+        return false;
     }
-    error(253, "If you read this, something went very wrong");
-    return false;
+    bool result = box_checker(box_pid);
+    close(comm[0]);
+    close_streams();
+#ifdef COTTON_LINUX
+    perf.close();
+#endif
+    trace::Phase phase("cleanup_hook");
+    if (!cleanup_hook()) return false;
+    return result;
+}
+
+int DummyUnixSandbox::open_parent(const std::string& box_path, bool create, std::string& name) const {
+    std::vector<std::string> parts;
+    for (size_t start = 0; start <= box_path.size(); ) {
+        size_t end = std::min(box_path.find('/', start), box_path.size());
+        std::string part = box_path.substr(start, end - start);
+        if (part == "..") {
+            error(2, "The path " + box_path + " is outside of the sandbox");
+            return -1;
+        }
+        if (!part.empty() && part != ".") parts.push_back(part);
+        start = end + 1;
+    }
+    if (parts.empty()) {
+        error(2, "The path in the sandbox must not be its root");
+        return -1;
+    }
+    // The folders are opened one at a time without following the links,
+    // which could lead out of the box.
+    int dir_fd = open(get_root().c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dir_fd == -1) {
+        error(4, serror("Error opening " + get_root()));
+        return -1;
+    }
+    for (size_t i=0; i+1<parts.size(); i++) {
+        if (create && mkdirat(dir_fd, parts[i].c_str(), box_mode) == -1 && errno != EEXIST) {
+            error(4, serror("Error creating the folders of " + box_path));
+            close(dir_fd);
+            return -1;
+        }
+        int next = openat(dir_fd, parts[i].c_str(), O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+        close(dir_fd);
+        if (next == -1) {
+            error(4, serror("Error opening the folders of " + box_path));
+            return -1;
+        }
+        dir_fd = next;
+    }
+    name = parts.back();
+    return dir_fd;
 }
 
+bool DummyUnixSandbox::import_file(const std::string& box_path, const std::string& orig_path, bool rw) {
+    std::string name;
+    int dir_fd = open_parent(box_path, true, name);
+    if (dir_fd == -1) return false;
+    FileStore store(base_path);
+    bool ok = import_into(store, orig_path, dir_fd, name, rw, true);
+    close(dir_fd);
+    return ok;
+}
+
+bool DummyUnixSandbox::import_into(FileStore& store, const std::string& orig_path, int dir_fd,
+    const std::string& name, bool rw, bool follow) {
+    struct stat st;
+    if ((follow ? stat(orig_path.c_str(), &st) : lstat(orig_path.c_str(), &st)) == -1) {
+        error(4, serror("Error importing " + orig_path));
+        return false;
+    }
+    if (S_ISLNK(st.st_mode)) {
+        // Copied as it is, so that a link to a parent folder is not a loop.
+        std::vector<char> target(st.st_size + 1);
+        ssize_t len = readlink(orig_path.c_str(), target.data(), target.size());
+        if (len == -1 || (size_t)len == target.size()) {
+            if (len != -1) errno = ENAMETOOLONG; // Changed in the meantime
+            error(4, serror("Error reading the link " + orig_path));
+            return false;
+        }
+        target[len] = 0;
+        if (unlinkat(dir_fd, name.c_str(), 0) == -1 && errno != ENOENT) {
+            error(4, serror("Error replacing " + name + " with " + orig_path));
+            return false;
+        }
+        if (symlinkat(target.data(), dir_fd, name.c_str()) == -1) {
+            error(4, serror("Error importing " + orig_path));
+            return false;
+        }
+        return true;
+    }
+    if (!S_ISDIR(st.st_mode)) {
+        std::string stored = store.add(orig_path);
+        if (stored.empty()) {
+            error(4, serror("Error adding " + orig_path + " to the store"));
+            return false;
+        }
+        if (unlinkat(dir_fd, name.c_str(), 0) == -1 && errno != ENOENT) {
+            error(4, serror("Error replacing " + name + " with " + orig_path));
+            return false;
+        }
+        if (!FileStore::place(stored, dir_fd, name, rw)) {
+            error(4, serror("Error importing " + orig_path));
+            return false;
+        }
+        return true;
+    }
+    if (mkdirat(dir_fd, name.c_str(), box_mode) == -1 && errno != EEXIST) {
+        error(4, serror("Error creating the folder " + name));
+        return false;
+    }
+    int sub_fd = openat(dir_fd, name.c_str(), O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    if (sub_fd == -1) {
+        error(4, serror("Error opening the folder " + name));
+        return false;
+    }
+    DIR* dir = opendir(orig_path.c_str());
+    if (dir == nullptr) {
+        error(4, serror("Error importing " + orig_path));
+        close(sub_fd);
+        return false;
+    }
+    bool ok = true;
+    struct dirent* entry;
+    while (ok && (entry = readdir(dir)) != nullptr) {
+        std::string entry_name = entry->d_name;
+        if (entry_name == "." || entry_name == "..") continue;
+        ok = import_into(store, orig_path + "/" + entry_name, sub_fd, entry_name, rw, false);
+    }
+    closedir(dir);
+    close(sub_fd);
+    return ok;
+}
+
+std::vector<ExportedFile> DummyUnixSandbox::export_files(const std::vector<std::string>& patterns, int fd,
+    space_limit_t max_size) {
+    std::vector<ExportedFile> exported;
+    std::string root;
+    for (char c: get_root()) {
+        if (c == '*' || c == '?' || c == '[' || c == '\\') root += '\\';
+        root += c;
+    }
+    for (const auto& pattern: patterns) {
+        glob_t matches;
+        int ret = glob((root + pattern).c_str(), 0, nullptr, &matches);
+        if (ret == GLOB_NOMATCH) {
+            warning(2, "No file in the sandbox matches " + pattern);
+            continue;
+        }
+        if (ret != 0) {
+            error(4, "Error looking for " + pattern);
+            return exported;
+        }
+        bool ok = true;
+        for (size_t i=0; ok && i<matches.gl_pathc; i++) {
+            ExportedFile file;
+            file.path = matches.gl_pathv[i] + get_root().size();
+            ok = export_file(file, fd, max_size);
+            if (ok && !file.path.empty()) exported.push_back(file);
+        }
+        globfree(&matches);
+        if (!ok) break;
+    }
+    return exported;
+}
+
+bool DummyUnixSandbox::export_file(ExportedFile& file, int fd, space_limit_t max_size) {
+    // The names with a newline would break the header, and are skipped like
+    // everything that is not a regular file of the box.
+    std::string name;
+    int dir_fd = file.path.find('\n') == std::string::npos ? open_parent(file.path, false, name) : -1;
+    int file_fd = -1;
+    if (dir_fd != -1) {
+        file_fd = openat(dir_fd, name.c_str(), O_RDONLY | O_NOFOLLOW | O_NONBLOCK | O_CLOEXEC);
+        close(dir_fd);
+    }
+    struct stat st;
+    if (file_fd == -1 || fstat(file_fd, &st) == -1 || !S_ISREG(st.st_mode)) {
+        if (file_fd != -1) close(file_fd);
+        file.path.clear();
+        return true;
+    }
+    file.size = st.st_size;
+    if (max_size.bytes() != 0 && file.size > max_size.bytes()) {
+        file.size = max_size.bytes();
+        file.truncated = true;
+    }
+    std::string header = std::to_string(file.size) + (file.truncated ? " 1 " : " 0 ") + file.path + "\n";
+    bool ok = write_out(fd, header.c_str(), header.size()) && send_data(file_fd, fd, file.size);
+    if (!ok) error(4, serror("Error exporting " + file.path));
+    close(file_fd);
+    return ok;
+}
+
+bool DummyUnixSandbox::clear() {
+    int err = rm_rf_async(get_root(), trash_path());
+    if (err && err != ENOENT) {
+        error(4, serror("Error deleting file_root", err));
+        return false;
+    }
+    if (mkdir(get_root().c_str(), box_mode) == -1) {
+        error(4, serror("Error creating file_root"));
+        return false;
+    }
+    return true;
+}
 
 bool DummyUnixSandbox::delete_box() {
-    int err = rm_rf(box_base_path(base_path, id_));
-    if (err) error(4, serror("Error deleting sandbox", err));
-    return !err;
+    int err = rm_rf_async(box_base_path(base_path, id_), trash_path());
+    if (err) {
+        error(4, serror("Error deleting sandbox", err));
+        return false;
+    }
+    BoxIndex index(base_path);
+    if (index.is_open()) index.release(id_);
+    return true;
 }
 
 REGISTER_SANDBOX(DummyUnixSandbox);
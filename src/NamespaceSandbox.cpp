@@ -1,9 +1,18 @@
 #include "util.hpp"
 #ifdef COTTON_LINUX
 #include "NamespaceSandbox.hpp"
+#include "trace.hpp"
+#include "zygote.hpp"
 #include <sched.h>
+#include <signal.h>
+#include <linux/magic.h>
 #include <sys/mount.h>
+#include <sys/socket.h>
+#include <sys/statfs.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
 #include <unistd.h>
+#include <cstdio>
 
 bool NamespaceSandbox::is_available() const {
     return getuid() == 0; // It works only if the sandbox is setuid
@@ -13,57 +22,237 @@ std::string NamespaceSandbox::err_string(int error_id) const {
     if (error_id == 100) return "Error creating the new namespace";
     if (error_id == 101) return "Error setting up mountpoints";
     if (error_id == 102) return "Error changing the root";
-    if (error_id == 103) return "Error cleaning up mountpoints";
     return DummyUnixSandbox::err_string(error_id);
 }
 
 
-bool NamespaceSandbox::pre_fork_hook() {
+bool NamespaceSandbox::enter_namespaces() {
     Privileged p;
-    // Change PID namespace for the child process
-    if (unshare(CLONE_NEWPID) == -1) {
-        error(4, serror(err_string(100)));
-        return false;
+    if (mount_ns_fd != -1)
+        return unshare(CLONE_NEWNET | CLONE_NEWIPC) == 0 && setns(mount_ns_fd, CLONE_NEWNS) == 0;
+    if (unshare(CLONE_NEWNET | CLONE_NEWIPC | CLONE_NEWNS) == -1) return false;
+    // Receive the mounts of the host, but do not leak ours to it.
+    return ::mount(nullptr, "/", nullptr, MS_REC | MS_SLAVE, nullptr) == 0;
+}
+
+bool NamespaceSandbox::mount_all() {
+    Privileged p;
+    for (const auto& mnt: mountpoints) {
+        std::string source = mnt.second.first;
+        std::string target = get_root() + mnt.first;
+        unsigned long flags = MS_BIND | MS_NODEV | MS_NOSUID;
+        if (!mnt.second.second) flags |= MS_RDONLY;
+        if (::mount(source.c_str(), target.c_str(), "", flags, "") == -1) return false;
     }
     return true;
 }
 
-bool NamespaceSandbox::post_fork_hook() {
+bool NamespaceSandbox::create_mount_namespace() {
+    drop_mount_namespace();
+    std::string dir = mount_ns_path();
+    std::string file = dir + "mnt";
     Privileged p;
-    // Change namespace
-    if (unshare(CLONE_NEWNET | CLONE_NEWIPC | CLONE_NEWNS) == -1) {
-        send_error(100, errno);
+    if (mkdir(dir.c_str(), box_mode) == -1 && errno != EEXIST) {
+        error(4, serror("Error creating " + dir));
         return false;
     }
+    // The namespace would otherwise get the bind mount of its own file
+    // through the propagation from the host.
+    if (::mount(dir.c_str(), dir.c_str(), nullptr, MS_BIND, nullptr) == -1 ||
+        ::mount(nullptr, dir.c_str(), nullptr, MS_PRIVATE, nullptr) == -1) {
+        error(4, serror("Error making " + dir + " private"));
+        return false;
+    }
+    int fd = open(file.c_str(), O_RDONLY | O_CREAT | O_CLOEXEC, file_mode);
+    if (fd == -1) {
+        error(4, serror("Error creating " + file));
+        return false;
+    }
+    close(fd);
+    int sv[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv) == -1) {
+        error(4, serror("Error creating the socket"));
+        return false;
+    }
+    pid_t pid = fork();
+    if (pid == 0) {
+        // Sets up the namespace, and keeps it alive until it is bind mounted.
+        close(sv[0]);
+        int tmp[2] = {enter_namespaces() && mount_all(), errno};
+        send_all(sv[1], tmp, sizeof tmp);
+        char c;
+        read(sv[1], &c, 1);
+        _exit(0);
+    }
+    close(sv[1]);
+    int tmp[2] = {0, 0};
+    bool ok = pid != -1 && read_all(sv[0], tmp, sizeof tmp) && tmp[0];
+    int err = pid == -1 ? errno : tmp[1];
+    std::string ns = "/proc/" + std::to_string(pid) + "/ns/mnt";
+    if (ok && ::mount(ns.c_str(), file.c_str(), nullptr, MS_BIND, nullptr) == -1) {
+        ok = false;
+        err = errno;
+    }
+    close(sv[0]);
+    if (pid != -1) while (waitpid(pid, nullptr, 0) == -1 && errno == EINTR);
+    if (!ok) {
+        error(4, serror("Error setting up the mount namespace", err));
+        return false;
+    }
+    mount_ns_key = zygote_key();
     return true;
 }
 
-bool NamespaceSandbox::cleanup_hook() {
-    if (mountpoints.empty()) return true;
+bool NamespaceSandbox::open_mount_namespace() {
+    if (mount_ns_fd != -1) close(mount_ns_fd);
+    mount_ns_fd = -1;
+    std::string file = mount_ns_path() + "mnt";
+    for (int attempt = 0; attempt < 2; attempt++) {
+        if (mount_ns_key == zygote_key()) {
+            Privileged p;
+            mount_ns_fd = open(file.c_str(), O_RDONLY | O_CLOEXEC);
+            // After a reboot the file is still there, without the namespace.
+            struct statfs info;
+            if (mount_ns_fd != -1 && fstatfs(mount_ns_fd, &info) == 0 && info.f_type == NSFS_MAGIC) return true;
+            if (mount_ns_fd != -1) close(mount_ns_fd);
+            mount_ns_fd = -1;
+        }
+        if (attempt == 0 && !create_mount_namespace()) return false;
+    }
+    error(4, "Error opening the mount namespace " + file);
+    return false;
+}
+
+void NamespaceSandbox::drop_mount_namespace() {
+    mount_ns_key.clear();
     Privileged p;
-    for (const auto& mnt: mountpoints) {
-        std::string target = get_root() + mnt.first;
-        if (::umount(target.c_str()) == -1) {
-            send_error(103, errno);
-            return false;
+    // Also takes away the namespace file, mounted inside the folder.
+    std::string dir = mount_ns_path();
+    if (umount2(dir.c_str(), MNT_DETACH) == -1 && errno != EINVAL && errno != ENOENT)
+        warning(4, serror("Error unmounting " + dir));
+}
+
+std::string NamespaceSandbox::zygote_key() const {
+    std::string key = get_root() + "\n" + root_fs + "\n" + root_lower;
+    for (const auto& mnt: mountpoints)
+        key += "\n" + mnt.first + "\n" + mnt.second.first + (mnt.second.second ? "\nrw" : "\nro");
+    return key;
+}
+
+void NamespaceSandbox::stop_zygote() {
+    Zygote::stop(box_base_path(base_path, id_));
+}
+
+[[noreturn]] void NamespaceSandbox::zygote_child(const std::string& request, const std::vector<int>& fds) {
+    // The box is sent with every request, so that the child sees its current
+    // limits and redirections.
+    Sandbox* s = nullptr;
+    std::string command;
+    std::vector<std::string> args;
+    try {
+        BoxReader reader(request.data(), request.size());
+        s = reader.load_box();
+        reader >> command >> args;
+    } catch (std::exception& e) {}
+    NamespaceSandbox* box = dynamic_cast<NamespaceSandbox*>(s);
+    if (fds.empty()) _exit(1);
+    if (box == nullptr) {
+        int tmp[2] = {100, EINVAL};
+        write(fds[0], (void*)tmp, 2*sizeof(int));
+        _exit(1);
+    }
+    static const callback_t ignore = [](int, const std::string&) {};
+    box->set_error_handler(ignore);
+    box->set_warning_handler(ignore);
+    box->in_zygote = true;
+    box->comm[0] = -1;
+    box->comm[1] = fds[0];
+    // The streams from the parent follow, in order.
+    size_t next = 1;
+    for (int i=0; i<3; i++)
+        if (box->gets_stream_from_parent(i) && next < fds.size()) box->streams[i].child = fds[next++];
+    box->child_main(command, args);
+}
+
+pid_t NamespaceSandbox::fork_box(const std::string& command, const std::vector<std::string>& args) {
+    if (Zygote::is_enabled() || use_zygote) {
+        // The zygote already is in the new namespaces, with everything mounted:
+        // the child only needs to change its root.
+        auto setup = [this] {
+            in_zygote = true;
+            return enter_namespaces() && (mount_ns_fd != -1 || mount_all());
+        };
+        trace::begin("zygote");
+        Zygote* zygote = Zygote::get(box_base_path(base_path, id_), zygote_key(), CLONE_NEWPID,
+            setup, zygote_child);
+        trace::end("zygote");
+        if (zygote != nullptr) {
+            BoxWriter request;
+            request.save_box(*this);
+            request << command << args;
+            std::vector<int> fds = {comm[1]};
+            for (const auto& stream: streams)
+                if (stream.child != -1) fds.push_back(stream.child);
+            trace::begin("zygote_spawn");
+            pid_t box_pid = zygote->spawn(request.data(), fds);
+            trace::end("zygote_spawn");
+            if (box_pid != -1) {
+                // The child runs while the zygote is replying to us.
+                exec_unobserved = true;
+                return box_pid;
+            }
+            stop_zygote();
         }
+        // Without a zygote the errors are reported by the child, as usual.
+    }
+    pid_t box_pid;
+    {
+        Privileged p;
+        box_pid = syscall(SYS_clone, CLONE_NEWPID | SIGCHLD, 0, 0, 0, 0);
+    }
+    if (box_pid == 0) child_main(command, args);
+    if (box_pid == -1) error(4, serror(err_string(100)));
+    return box_pid;
+}
+
+std::vector<RunResult> NamespaceSandbox::run_many(const std::string& command, const std::vector<std::string>& args,
+    const std::vector<std::pair<std::string, std::string>>& cases) {
+    // Set up the namespaces and the mounts only once, in a zygote, even if
+    // they are not kept between commands.
+    use_zygote = cases.size() > 1;
+    auto results = DummyUnixSandbox::run_many(command, args, cases);
+    if (use_zygote && !Zygote::is_enabled()) stop_zygote();
+    use_zygote = false;
+    return results;
+}
+
+bool NamespaceSandbox::pre_fork_hook() {
+    if (!mountpoints.empty() && !open_mount_namespace()) return false;
+    return DummyUnixSandbox::pre_fork_hook();
+}
+
+bool NamespaceSandbox::cleanup_hook() {
+    if (mount_ns_fd != -1) close(mount_ns_fd);
+    mount_ns_fd = -1;
+    return DummyUnixSandbox::cleanup_hook();
+}
+
+bool NamespaceSandbox::post_fork_hook() {
+    if (in_zygote) return true;
+    if (!enter_namespaces()) {
+        send_error(100, errno);
+        return false;
     }
     return true;
 }
 
 bool NamespaceSandbox::pre_exec_hook() {
     if (mountpoints.empty()) return true;
-    Privileged p;
-    for (const auto& mnt: mountpoints) {
-        std::string source = mnt.second.first;
-        std::string target = get_root() + mnt.first;
-        unsigned long flags = MS_BIND | MS_NODEV | MS_NOSUID;
-        if (!mnt.second.second) flags |= MS_RDONLY;
-        if (::mount(source.c_str(), target.c_str(), "", flags, "") == -1) {
-            send_error(101, errno);
-            return false;
-        }
+    if (!in_zygote && mount_ns_fd == -1 && !mount_all()) {
+        send_error(101, errno);
+        return false;
     }
+    Privileged p;
     if (chroot(".") == -1) {
         send_error(102, errno);
         return false;
@@ -89,5 +278,127 @@ bool NamespaceSandbox::umount(const std::string& box_path) {
     return mountpoints.erase(box_path);
 }
 
+void NamespaceSandbox::set_limits() {
+    // A tmpfs enforces the disk limit on its own, without killing the box.
+    if (root_fs != "dir") disk_limit = 0;
+    DummyUnixSandbox::set_limits();
+}
+
+std::string NamespaceSandbox::tmpfs_options(mode_t mode) const {
+    char options[128];
+    // The files belong to the user that runs cotton, not to root.
+    snprintf(options, sizeof options, "size=%zu,mode=%o,uid=%d,gid=%d",
+        disk_limit.bytes(), mode, (int)geteuid(), (int)getegid());
+    return options;
+}
+
+bool NamespaceSandbox::create_mountpoints() {
+    for (const auto& mnt: mountpoints) {
+        if (mkdirs(get_root() + mnt.first, box_mode) == -1) {
+            error(4, serror("mkdirs"));
+            return false;
+        }
+    }
+    return true;
+}
+
+bool NamespaceSandbox::mount_root() {
+    if (root_fs == "dir") return create_mountpoints();
+    std::string tmpfs_target = root_fs == "tmpfs" ? get_root() : overlay_path();
+    if (root_fs == "overlay" && mkdir(tmpfs_target.c_str(), box_mode) == -1 && errno != EEXIST) {
+        error(4, serror("Error creating " + tmpfs_target));
+        return false;
+    }
+    std::string options = tmpfs_options(box_mode);
+    {
+        Privileged p;
+        if (::mount("tmpfs", tmpfs_target.c_str(), "tmpfs", MS_NODEV | MS_NOSUID, options.c_str()) == -1) {
+            error(4, serror("Error mounting a tmpfs on " + tmpfs_target));
+            return false;
+        }
+    }
+    if (root_fs == "overlay") {
+        std::string upper = overlay_path() + "upper";
+        std::string work = overlay_path() + "work";
+        if (mkdir(upper.c_str(), box_mode) == -1 || mkdir(work.c_str(), box_mode) == -1) {
+            error(4, serror("Error creating the overlay folders"));
+            return false;
+        }
+        options = "lowerdir=" + root_lower + ",upperdir=" + upper + ",workdir=" + work;
+        Privileged p;
+        if (::mount("overlay", get_root().c_str(), "overlay", MS_NODEV | MS_NOSUID, options.c_str()) == -1) {
+            error(4, serror("Error mounting the overlay on " + get_root()));
+            return false;
+        }
+    }
+    return create_mountpoints();
+}
+
+bool NamespaceSandbox::umount_root() {
+    if (root_fs == "dir") return true;
+    Privileged p;
+    // EINVAL means that it was not mounted, for example after a reboot.
+    if (umount2(get_root().c_str(), MNT_DETACH) == -1 && errno != EINVAL) {
+        error(4, serror("Error unmounting " + get_root()));
+        return false;
+    }
+    if (root_fs == "overlay" && umount2(overlay_path().c_str(), MNT_DETACH) == -1 && errno != EINVAL) {
+        error(4, serror("Error unmounting " + overlay_path()));
+        return false;
+    }
+    return true;
+}
+
+bool NamespaceSandbox::set_root_fs(const std::string& type, const std::string& lower_path) {
+    if (type != "dir" && type != "tmpfs" && type != "overlay") {
+        error(2, "Unknown root filesystem " + type);
+        return false;
+    }
+    if (type == "overlay" && (lower_path.empty() || lower_path[0] != '/')) {
+        error(2, "An overlay root needs the absolute path of its lower folder");
+        return false;
+    }
+    // The mount options are separated by commas, the lower folders by colons,
+    // and backslashes escape them.
+    if (type == "overlay" && lower_path.find_first_of(",:\\") != std::string::npos) {
+        error(2, "The lower folder of an overlay root cannot contain ',', ':' or '\\'");
+        return false;
+    }
+    stop_zygote();
+    drop_mount_namespace();
+    if (!umount_root()) return false;
+    root_fs = type;
+    root_lower = type == "overlay" ? lower_path : "";
+    return mount_root();
+}
+
+bool NamespaceSandbox::set_disk_limit(space_limit_t limit) {
+    disk_limit = limit;
+    if (root_fs == "dir") return true;
+    std::string target = root_fs == "tmpfs" ? get_root() : overlay_path();
+    std::string options = tmpfs_options(box_mode);
+    Privileged p;
+    if (::mount("tmpfs", target.c_str(), "tmpfs", MS_REMOUNT | MS_NODEV | MS_NOSUID, options.c_str()) == -1) {
+        error(4, serror("Error resizing the tmpfs on " + target));
+        return false;
+    }
+    return true;
+}
+
+bool NamespaceSandbox::clear() {
+    // The zygote and the mount namespace still see the old root.
+    stop_zygote();
+    drop_mount_namespace();
+    if (root_fs == "dir") return DummyUnixSandbox::clear() && create_mountpoints();
+    // Throwing away the tmpfs takes the same time whatever is inside it.
+    return umount_root() && mount_root();
+}
+
+bool NamespaceSandbox::delete_box() {
+    stop_zygote();
+    drop_mount_namespace();
+    return umount_root() && DummyUnixSandbox::delete_box();
+}
+
 REGISTER_SANDBOX(NamespaceSandbox);
 #endif
@@ -0,0 +1,242 @@
+#include "util.hpp"
+#ifdef COTTON_LINUX
+#include "SeccompSandbox.hpp"
+#include <algorithm>
+#include <cstddef>
+#include <map>
+#include <cstring>
+#include <linux/audit.h>
+#include <linux/seccomp.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <sys/prctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace {
+#if defined(__x86_64__)
+const uint32_t audit_arch = AUDIT_ARCH_X86_64;
+#elif defined(__aarch64__)
+const uint32_t audit_arch = AUDIT_ARCH_AARCH64;
+#elif defined(__i386__)
+const uint32_t audit_arch = AUDIT_ARCH_I386;
+#else
+const uint32_t audit_arch = 0; // Unknown, the filters are not available
+#endif
+
+// What a program compiled from C or C++ needs to run, including the dynamic
+// loader, reading and writing files, the clocks and the signals.
+std::vector<int> program_syscalls() {
+    return {
+        SYS_read, SYS_write, SYS_readv, SYS_writev, SYS_pread64, SYS_pwrite64, SYS_lseek, SYS_close,
+        SYS_openat, SYS_fstat, SYS_newfstatat, SYS_statx, SYS_faccessat, SYS_readlinkat, SYS_ioctl,
+        SYS_fcntl, SYS_dup, SYS_dup3, SYS_ppoll, SYS_pselect6, SYS_getcwd,
+        SYS_mmap, SYS_munmap, SYS_mprotect, SYS_mremap, SYS_madvise, SYS_brk,
+        SYS_exit, SYS_exit_group, SYS_rt_sigaction, SYS_rt_sigprocmask, SYS_rt_sigreturn, SYS_sigaltstack,
+        SYS_tgkill, SYS_set_tid_address, SYS_set_robust_list, SYS_futex, SYS_sched_yield,
+        SYS_sched_getaffinity, SYS_prlimit64, SYS_getrlimit, SYS_getrandom, SYS_uname, SYS_sysinfo,
+        SYS_clock_gettime, SYS_clock_getres, SYS_clock_nanosleep, SYS_nanosleep, SYS_gettimeofday,
+        SYS_getrusage, SYS_times, SYS_getpid, SYS_gettid, SYS_getppid,
+        SYS_getuid, SYS_geteuid, SYS_getgid, SYS_getegid,
+#ifdef SYS_faccessat2
+        SYS_faccessat2,
+#endif
+#ifdef SYS_rseq
+        SYS_rseq,
+#endif
+#ifdef SYS_arch_prctl
+        SYS_arch_prctl,
+#endif
+#ifdef SYS_open
+        SYS_open, SYS_stat, SYS_lstat, SYS_access, SYS_readlink, SYS_dup2, SYS_poll, SYS_select, SYS_time,
+#endif
+    };
+}
+
+// The interpreters also list directories and start threads.
+std::vector<int> interpreter_syscalls() {
+    auto syscalls = program_syscalls();
+    syscalls.insert(syscalls.end(), {
+        SYS_getdents64, SYS_fstatfs, SYS_statfs, SYS_pipe2, SYS_clone, SYS_mincore,
+        SYS_epoll_create1, SYS_epoll_ctl, SYS_epoll_pwait, SYS_eventfd2,
+#ifdef SYS_clone3
+        SYS_clone3,
+#endif
+#ifdef SYS_open
+        SYS_getdents, SYS_pipe, SYS_epoll_wait,
+#endif
+    });
+    return syscalls;
+}
+
+// The compilers run other programs, and write and remove files.
+std::vector<int> compiler_syscalls() {
+    auto syscalls = interpreter_syscalls();
+    syscalls.insert(syscalls.end(), {
+        SYS_execve, SYS_wait4, SYS_waitid, SYS_kill, SYS_getpgid, SYS_setpgid, SYS_umask, SYS_chdir, SYS_fchdir,
+        SYS_unlinkat, SYS_renameat, SYS_mkdirat, SYS_fchmod, SYS_fchmodat, SYS_ftruncate, SYS_fallocate,
+        SYS_linkat, SYS_symlinkat, SYS_utimensat, SYS_setrlimit, SYS_prctl,
+#ifdef SYS_renameat2
+        SYS_renameat2,
+#endif
+#ifdef SYS_open
+        SYS_fork, SYS_vfork, SYS_unlink, SYS_rename, SYS_mkdir, SYS_rmdir, SYS_chmod, SYS_link, SYS_symlink,
+        SYS_getpgrp,
+#endif
+    });
+    return syscalls;
+}
+
+const std::map<std::string, std::vector<int>>& profiles() {
+    static const std::map<std::string, std::vector<int>> profiles = {
+        {"program", program_syscalls()},
+        {"python", interpreter_syscalls()},
+        {"compiler", compiler_syscalls()}
+    };
+    return profiles;
+}
+
+// Where compile puts the descriptor that sendmsg is allowed on.
+size_t comm_fd_index = 0;
+
+// Allows the given syscalls and sends the others to the listener.
+std::vector<struct sock_filter> compile(std::vector<int> allowed) {
+    std::sort(allowed.begin(), allowed.end());
+    allowed.erase(std::unique(allowed.begin(), allowed.end()), allowed.end());
+    std::vector<struct sock_filter> filter = {
+        BPF_STMT(BPF_LD | BPF_W | BPF_ABS, offsetof(struct seccomp_data, arch)),
+        BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, audit_arch, 1, 0),
+        BPF_STMT(BPF_RET | BPF_K, SECCOMP_RET_KILL_PROCESS),
+        BPF_STMT(BPF_LD | BPF_W | BPF_ABS, offsetof(struct seccomp_data, nr)),
+#ifdef __x86_64__
+        // The x32 syscalls have the same arch, and this bit set.
+        BPF_JUMP(BPF_JMP | BPF_JGE | BPF_K, 0x40000000, 0, 1),
+        BPF_STMT(BPF_RET | BPF_K, SECCOMP_RET_KILL_PROCESS),
+#endif
+        // The listener is sent to the parent after the filter is installed,
+        // so sendmsg is allowed on the socket to the parent, which is closed by
+        // the exec. The lower half of the descriptor is enough, as the kernel
+        // truncates it to an int; all the supported architectures are little
+        // endian.
+        BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, SYS_sendmsg, 0, 4),
+        BPF_STMT(BPF_LD | BPF_W | BPF_ABS, offsetof(struct seccomp_data, args[0])),
+        BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 0, 0, 1), // Set by the child
+        BPF_STMT(BPF_RET | BPF_K, SECCOMP_RET_ALLOW),
+        BPF_STMT(BPF_RET | BPF_K, SECCOMP_RET_USER_NOTIF),
+    };
+    comm_fd_index = filter.size() - 3;
+    // Every match jumps over the rest of the list to the last instruction.
+    size_t count = allowed.size();
+    for (size_t i=0; i<count; i++)
+        filter.push_back(BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, (uint32_t)allowed[i], (uint8_t)(count - i), 0));
+    filter.push_back(BPF_STMT(BPF_RET | BPF_K, SECCOMP_RET_USER_NOTIF));
+    filter.push_back(BPF_STMT(BPF_RET | BPF_K, SECCOMP_RET_ALLOW));
+    return filter;
+}
+}
+
+std::vector<struct sock_filter>* SeccompSandbox::compiled_filter(const std::string& profile) {
+    static std::map<std::string, std::vector<struct sock_filter>> cache;
+    auto cached = cache.find(profile);
+    if (cached != cache.end()) return &cached->second;
+    auto syscalls = profiles().find(profile);
+    if (syscalls == profiles().end()) return nullptr;
+    return &(cache[profile] = compile(syscalls->second));
+}
+
+bool SeccompSandbox::allows_exec(const std::string& profile) {
+    auto syscalls = profiles().find(profile);
+    if (syscalls == profiles().end()) return false;
+    const auto& list = syscalls->second;
+    return std::find(list.begin(), list.end(), SYS_execve) != list.end();
+}
+
+bool SeccompSandbox::is_available() const {
+    if (!NamespaceSandbox::is_available() || audit_arch == 0) return false;
+    uint32_t action = SECCOMP_RET_USER_NOTIF;
+    return syscall(SYS_seccomp, SECCOMP_GET_ACTION_AVAIL, 0, &action) == 0;
+}
+
+std::string SeccompSandbox::err_string(int error_id) const {
+    if (error_id == 300) return "Error installing the syscall filter";
+    return NamespaceSandbox::err_string(error_id);
+}
+
+bool SeccompSandbox::set_syscall_profile(const std::string& profile) {
+    if (!profile.empty() && profiles().count(profile) == 0) {
+        error(2, "Unknown syscall profile " + profile);
+        return false;
+    }
+    syscall_profile = profile;
+    return true;
+}
+
+bool SeccompSandbox::pre_fork_hook() {
+    // Compiled here, the filter is inherited by the child of every run.
+    if (!syscall_profile.empty()) compiled_filter(syscall_profile);
+    return NamespaceSandbox::pre_fork_hook();
+}
+
+bool SeccompSandbox::pre_execv_hook() {
+    if (syscall_profile.empty()) return true;
+    // The filter is a copy of the one of the parent, after the fork.
+    auto* filter = compiled_filter(syscall_profile);
+    (*filter)[comm_fd_index].k = comm[1];
+    struct sock_fprog prog = {(unsigned short)filter->size(), const_cast<struct sock_filter*>(filter->data())};
+    if (prctl(PR_SET_NO_NEW_PRIVS, 1, 0, 0, 0) == -1) {
+        send_error(300, errno);
+        return false;
+    }
+    int fd = syscall(SYS_seccomp, SECCOMP_SET_MODE_FILTER, SECCOMP_FILTER_FLAG_NEW_LISTENER, &prog);
+    if (fd == -1) {
+        send_error(300, errno);
+        return false;
+    }
+    int msg[2] = {listener_opened, 0};
+    bool ok = send_fds(comm[1], msg, sizeof msg, &fd, 1);
+    close(fd);
+    return ok;
+}
+
+bool SeccompSandbox::child_message_hook(int message_id, int value, const std::vector<int>& fds,
+    std::string& kill_reason) {
+    if (message_id != listener_opened || fds.empty())
+        return NamespaceSandbox::child_message_hook(message_id, value, fds, kill_reason);
+    if (listener != -1) close(listener);
+    listener = fds[0];
+    for (size_t i=1; i<fds.size(); i++) close(fds[i]);
+    if (allows_exec(syscall_profile)) return true;
+    // The exec of the program is stopped by the filter, and is let through
+    // only this time.
+    return check_syscall(true, kill_reason);
+}
+
+bool SeccompSandbox::check_syscall(bool allow_exec, std::string& kill_reason) {
+    struct pollfd fd = {listener, POLLIN, 0};
+    while (poll(&fd, 1, -1) == -1 && errno == EINTR);
+    if (!(fd.revents & POLLIN)) return true; // The program is gone
+    struct seccomp_notif req;
+    memset(&req, 0, sizeof req);
+    // Fails if the program was killed in the meantime.
+    if (ioctl(listener, SECCOMP_IOCTL_NOTIF_RECV, &req) == -1) return true;
+    if (allow_exec && req.data.nr == SYS_execve) {
+        struct seccomp_notif_resp resp;
+        memset(&resp, 0, sizeof resp);
+        resp.id = req.id;
+        resp.flags = SECCOMP_USER_NOTIF_FLAG_CONTINUE;
+        if (ioctl(listener, SECCOMP_IOCTL_NOTIF_SEND, &resp) == 0 || errno == ENOENT) return true;
+        error(5, serror("Error starting the program"));
+        return false;
+    }
+    kill_reason = "Forbidden syscall " + std::to_string(req.data.nr);
+    return false;
+}
+
+bool SeccompSandbox::cleanup_hook() {
+    if (listener != -1) close(listener);
+    listener = -1;
+    return NamespaceSandbox::cleanup_hook();
+}
+
+REGISTER_SANDBOX(SeccompSandbox);
+#endif
@@ -0,0 +1,86 @@
+#include "box_archive.hpp"
+#include "box.hpp"
+#include <fcntl.h>
+#include <fstream>
+#include <memory>
+#include <sys/stat.h>
+#include <unistd.h>
+
+BoxSerializers* box_serializers;
+BoxTypeNames* box_type_names;
+
+void BoxWriter::save_box(const Sandbox& box) {
+    auto name = box_type_names->find(typeid(box));
+    if (name == box_type_names->end()) throw std::runtime_error("Unregistered box type");
+    *this & name->second;
+    (*box_serializers)[name->second].save(*this, const_cast<Sandbox&>(box));
+}
+
+Sandbox* BoxReader::load_box() {
+    std::string name;
+    *this & name;
+    auto serializer = box_serializers->find(name);
+    if (serializer == box_serializers->end()) throw std::runtime_error("Unknown box type " + name);
+    std::unique_ptr<Sandbox> box((*box_creators)[name](""));
+    serializer->second.load(*this, *box);
+    return box.release();
+}
+
+namespace {
+// Boxes created before the binary format was introduced.
+Sandbox* read_text_box_info(const std::string& path) {
+    std::ifstream fin(path);
+    boost::archive::text_iarchive ia{fin};
+    Sandbox* s;
+    ia >> s;
+    return s;
+}
+}
+
+Sandbox* read_box_info(const std::string& path) {
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd == -1) throw std::runtime_error(serror("Cannot open " + path));
+    struct stat info;
+    if (fstat(fd, &info) == -1) {
+        int err = errno;
+        close(fd);
+        throw std::runtime_error(serror("Cannot read " + path, err));
+    }
+    std::string data(info.st_size, 0);
+    ssize_t nread = pread(fd, &data[0], data.size(), 0);
+    close(fd);
+    BoxInfoHeader header;
+    if (nread < (ssize_t)sizeof header) return read_text_box_info(path);
+    memcpy(&header, data.data(), sizeof header);
+    if (memcmp(header.magic, BoxInfoHeader::magic_value, sizeof header.magic) != 0)
+        return read_text_box_info(path);
+    if (header.version > BoxInfoHeader::current_version)
+        throw std::runtime_error("The box was saved by a newer version of cotton");
+    if (header.size != nread - sizeof header) throw std::runtime_error("Truncated box state");
+    BoxReader reader(data.data() + sizeof header, header.size);
+    return reader.load_box();
+}
+
+void write_box_info(const std::string& path, const Sandbox& box, bool sync) {
+    BoxWriter writer;
+    writer.save_box(box);
+    BoxInfoHeader header = {};
+    memcpy(header.magic, BoxInfoHeader::magic_value, sizeof header.magic);
+    header.version = BoxInfoHeader::current_version;
+    header.size = writer.data().size();
+    std::string data((const char*)&header, sizeof header);
+    data += writer.data();
+    // Readers see either the old or the new file, never a partial one.
+    std::string tmp_path = path + ".tmp" + std::to_string(getpid());
+    int fd = open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd == -1) throw std::runtime_error(serror("Cannot create " + tmp_path));
+    // Synced first, or a crash could leave the new name on an empty file.
+    bool ok = write(fd, data.data(), data.size()) == (ssize_t)data.size() && (!sync || fsync(fd) == 0);
+    int err = errno;
+    close(fd);
+    if (!ok || rename(tmp_path.c_str(), path.c_str()) == -1) {
+        if (ok) err = errno;
+        unlink(tmp_path.c_str());
+        throw std::runtime_error(serror("Cannot write " + path, err));
+    }
+}
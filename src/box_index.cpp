@@ -0,0 +1,140 @@
+#include "util.hpp"
+#ifdef COTTON_UNIX
+#include "box_index.hpp"
+#include "box.hpp"
+#include <dirent.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+BoxIndex::BoxIndex(const std::string& base_path): base_path(base_path) {
+    fd = open((base_path + "/box_index").c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd == -1) return;
+    while (flock(fd, LOCK_EX) == -1) {
+        if (errno == EINTR) continue;
+        int err = errno;
+        close(fd);
+        fd = -1;
+        errno = err;
+        return;
+    }
+    struct stat info;
+    fstat(fd, &info);
+    if (info.st_size < (off_t)sizeof header || pread(fd, &header, sizeof header, 0) != sizeof header ||
+        header.magic != magic_value) {
+        // New index: take over the boxes created before it existed.
+        rebuild();
+        return;
+    }
+    size_t size = info.st_size - sizeof header;
+    bitmap.resize((size + sizeof(uint64_t) - 1) / sizeof(uint64_t));
+    if (pread(fd, bitmap.data(), size, sizeof header) != (ssize_t)size) rebuild();
+}
+
+BoxIndex::~BoxIndex() {
+    if (fd != -1) close(fd); // Also releases the lock
+}
+
+void BoxIndex::set(size_t id, bool used) {
+    size_t word = id / 64;
+    if (word >= bitmap.size()) {
+        if (!used) return;
+        bitmap.resize(word + 1);
+    }
+    uint64_t bit = 1ULL << (id % 64);
+    bitmap[word] = used ? bitmap[word] | bit : bitmap[word] & ~bit;
+    pwrite(fd, &bitmap[word], sizeof(uint64_t), sizeof header + word * sizeof(uint64_t));
+    if (!used && word < header.free_hint) {
+        header.free_hint = word;
+        write_header();
+    }
+}
+
+void BoxIndex::write_header() {
+    pwrite(fd, &header, sizeof header, 0);
+}
+
+size_t BoxIndex::allocate(size_t box_limit) {
+    for (int attempt = 0; attempt < 2; attempt++) {
+        size_t word = header.free_hint;
+        while (word < bitmap.size() && ~bitmap[word] == 0) word++;
+        if (word != header.free_hint) {
+            header.free_hint = word;
+            write_header();
+        }
+        size_t id = word < bitmap.size() ? word * 64 + __builtin_ctzll(~bitmap[word]) : bitmap.size() * 64;
+        bool full = word == bitmap.size();
+        if (id < box_limit && (!full || attempt == 1 || bitmap.size() < header.reap_at)) {
+            mark(id);
+            return id;
+        }
+        if (attempt == 1) break;
+        // Every known id below the limit is taken: look for leaked ones, but
+        // not more often than the bitmap doubles while it grows.
+        reap();
+        header.reap_at = 2 * bitmap.size();
+        write_header();
+    }
+    return 0;
+}
+
+void BoxIndex::rebuild() {
+    bitmap.clear();
+    ftruncate(fd, 0);
+    header = {magic_value, 0, 0};
+    write_header();
+    mark(0); // Box ids start from 1
+    DIR* dir = opendir(base_path.c_str());
+    if (dir == nullptr) return;
+    struct dirent* entry;
+    while ((entry = readdir(dir))) {
+        std::string name = entry->d_name;
+        if (name.compare(0, 4, "box_") != 0) continue;
+        char* end;
+        size_t id = strtoull(name.c_str() + 4, &end, 10);
+        if (*end != 0 || id == 0) continue;
+        if (access((Sandbox::box_base_path(base_path, id) + "lock").c_str(), F_OK) == 0) mark(id);
+    }
+    closedir(dir);
+}
+
+void BoxIndex::reap() {
+    for (size_t id = 1; id < bitmap.size() * 64; id++) {
+        if (!(bitmap[id / 64] & (1ULL << (id % 64)))) continue;
+        std::string box_path = Sandbox::box_base_path(base_path, id);
+        if (access((box_path + "lock").c_str(), F_OK) == -1 && errno == ENOENT) {
+            release(id);
+        } else if (access((box_path + "boxinfo").c_str(), F_OK) == -1 && errno == ENOENT &&
+            is_stale_lock(box_path + "lock")) {
+            if (rm_rf(box_path) == 0) release(id);
+        }
+    }
+}
+
+bool BoxIndex::create_lock(const std::string& lock_file, mode_t mode) {
+    int lock_fd = open(lock_file.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, mode);
+    if (lock_fd == -1) return false;
+    std::string owner = std::to_string(getpid()) + "\n";
+    write(lock_fd, owner.c_str(), owner.size());
+    close(lock_fd);
+    return true;
+}
+
+pid_t BoxIndex::lock_owner(const std::string& lock_file) {
+    int lock_fd = open(lock_file.c_str(), O_RDONLY | O_CLOEXEC);
+    if (lock_fd == -1) return 0;
+    char buf[32] = {};
+    ssize_t len = read(lock_fd, buf, sizeof buf - 1);
+    close(lock_fd);
+    if (len <= 0) return 0;
+    return atoi(buf);
+}
+
+bool BoxIndex::is_stale_lock(const std::string& lock_file) {
+    pid_t owner = lock_owner(lock_file);
+    return owner > 0 && kill(owner, 0) == -1 && errno == ESRCH;
+}
+
+#endif
@@ -0,0 +1,826 @@
+#include "commands.hpp"
+#include "box_archive.hpp"
+#include "logger.hpp"
+#include "trace.hpp"
+#include "zygote.hpp"
+#include <algorithm>
+#include <functional>
+#include <map>
+#include <stdexcept>
+#include <tuple>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+namespace {
+struct CachedBox {
+    std::shared_ptr<Sandbox> box;
+    struct stat info;
+};
+
+bool box_cache_enabled = false;
+std::map<std::string, CachedBox> box_cache;
+int run_cpu = -1;
+std::vector<int> passed_fds;
+
+// Applies the cpu chosen with set_run_cpu to a box that is about to run.
+bool pin_box(const std::shared_ptr<Sandbox>& s) {
+    if (!(s->get_features() & Sandbox::cpu_affinity)) return true;
+    return s->set_cpu(run_cpu);
+}
+
+// Replaces the index of a passed file descriptor in a "fd:N" redirection with
+// the descriptor itself.
+bool resolve_passed_fd(std::string& redirect) {
+    if (passed_fds.empty() || redirect.compare(0, 3, "fd:") != 0) return true;
+    size_t index = std::stoul(redirect.substr(3));
+    if (index >= passed_fds.size()) {
+        logger->error(2, "Only " + std::to_string(passed_fds.size()) + " file descriptors were passed");
+        return false;
+    }
+    redirect = "fd:" + std::to_string(passed_fds[index]);
+    return true;
+}
+
+// Opens where export writes: "fd:N", which is not closed after the export, or
+// the path of a unix socket to connect to. Returns -1 on failure.
+int open_export_destination(std::string dest, bool& owned) {
+    owned = false;
+    if (!resolve_passed_fd(dest)) return -1;
+    if (dest.compare(0, 3, "fd:") == 0) return std::stoi(dest.substr(3));
+    struct sockaddr_un addr = {};
+    addr.sun_family = AF_UNIX;
+    if (dest.size() >= sizeof addr.sun_path) {
+        logger->error(2, "The socket path is too long");
+        return -1;
+    }
+    strcpy(addr.sun_path, dest.c_str());
+    int sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (sock == -1 || connect(sock, (struct sockaddr*)&addr, sizeof addr) == -1) {
+        logger->error(4, serror("Error connecting to " + dest));
+        if (sock != -1) close(sock);
+        return -1;
+    }
+    owned = true;
+    return sock;
+}
+
+bool same_file_version(const struct stat& a, const struct stat& b) {
+    return a.st_ino == b.st_ino && a.st_size == b.st_size &&
+        a.st_mtim.tv_sec == b.st_mtim.tv_sec && a.st_mtim.tv_nsec == b.st_mtim.tv_nsec;
+}
+
+void attach_logger(Sandbox* s) {
+    s->set_error_handler(logger->get_error_function());
+    s->set_warning_handler(logger->get_warning_function());
+}
+
+// One of the two programs of run_interactive, which runs in its own process.
+struct InteractiveRun {
+    std::shared_ptr<Sandbox> box;
+    std::string exec;
+    std::vector<std::string> args;
+    pid_t pid = -1;
+    int sock = -1;
+    std::string reply;
+};
+
+typedef std::vector<std::pair<int, std::string>> messages_t;
+
+// Starts a process that runs the program with the given stdin and stdout, and
+// sends back the result with the errors and the warnings. The process closes
+// unused_fds, so that the other program sees the end of its input as soon as
+// this one exits.
+bool start_interactive(const std::string& box_root, InteractiveRun& run, int in_fd, int out_fd, int cancel_fd,
+    const std::vector<int>& unused_fds) {
+    int sv[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv) == -1) {
+        logger->error(4, serror("Error creating the socket"));
+        return false;
+    }
+    run.pid = fork();
+    if (run.pid == 0) {
+#ifdef COTTON_LINUX
+        Zygote::disable_after_fork();
+#endif
+        close(sv[0]);
+        for (int fd: unused_fds) close(fd);
+        messages_t errors, warnings;
+        callback_t on_error = [&errors](int code, const std::string& msg) {errors.emplace_back(code, msg);};
+        callback_t on_warning = [&warnings](int code, const std::string& msg) {warnings.emplace_back(code, msg);};
+        Sandbox* s = run.box.get();
+        s->set_error_handler(on_error);
+        s->set_warning_handler(on_warning);
+        // As a single case of run_many, which restores the redirections of the
+        // box without opening them again.
+        RunResult res;
+        if (s->set_cancel_fd(cancel_fd) && pin_box(run.box)) {
+            auto results = s->run_many(run.exec, run.args,
+                {{"fd:" + std::to_string(in_fd), "fd:" + std::to_string(out_fd)}});
+            if (!results.empty()) res = results[0];
+        }
+        s->set_cancel_fd(-1);
+        save_box(box_root, run.box);
+        BoxWriter reply;
+        reply << res << errors << warnings;
+        send_all(sv[1], reply.data().data(), reply.data().size());
+        _exit(0);
+    }
+    close(sv[1]);
+    if (run.pid == -1) {
+        close(sv[0]);
+        logger->error(4, serror("Error starting the command"));
+        return false;
+    }
+    run.sock = sv[0];
+    return true;
+}
+
+// Waits for the process of a run to send its result and to exit.
+RunResult finish_interactive(InteractiveRun& run) {
+    close(run.sock);
+    run.sock = -1;
+    while (waitpid(run.pid, nullptr, 0) == -1 && errno == EINTR);
+    RunResult res;
+    messages_t errors, warnings;
+    try {
+        BoxReader reader(run.reply.data(), run.reply.size());
+        reader >> res >> errors >> warnings;
+    } catch (std::exception& e) {
+        logger->error(4, "The command was interrupted");
+        return RunResult();
+    }
+    for (const auto& err: errors) logger->error(err.first, err.second);
+    for (const auto& warn: warnings) logger->warning(warn.first, warn.second);
+    return res;
+}
+
+void close_pipe(int fds[2]) {
+    if (fds[0] != -1) close(fds[0]);
+    if (fds[1] != -1) close(fds[1]);
+}
+
+bool open_pipe(int fds[2]) {
+    if (pipe(fds) == -1) {
+        fds[0] = fds[1] = -1;
+        logger->error(4, serror("Error creating a pipe"));
+        return false;
+    }
+    fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+    fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+    return true;
+}
+}
+
+void set_box_cache(bool enabled) {
+    box_cache_enabled = enabled;
+    if (!enabled) box_cache.clear();
+}
+
+void set_run_cpu(int cpu) {
+    run_cpu = cpu;
+}
+
+void set_passed_fds(const std::vector<int>& fds) {
+    passed_fds = fds;
+}
+
+std::shared_ptr<Sandbox> load_box(const std::string& box_root, const std::string& box_id) {
+    trace::Phase phase("load_box");
+    try {
+        std::string path = Sandbox::box_base_path(box_root, std::stoi(box_id)) + "boxinfo";
+        struct stat info;
+        bool cacheable = box_cache_enabled && stat(path.c_str(), &info) == 0;
+        if (cacheable) {
+            auto cached = box_cache.find(path);
+            if (cached != box_cache.end() && same_file_version(cached->second.info, info)) {
+                attach_logger(cached->second.box.get());
+                return cached->second.box;
+            }
+        }
+        Sandbox* s = read_box_info(path);
+        attach_logger(s);
+        std::shared_ptr<Sandbox> box(s);
+        if (cacheable) box_cache[path] = {box, info};
+        return box;
+    } catch (std::exception& e) {
+        logger->error(3, std::string("Error loading the sandbox: ") + e.what());
+        return nullptr;
+    }
+}
+
+void save_box(const std::string& box_root, const std::shared_ptr<Sandbox>& s) {
+    if (s.get() == nullptr) return;
+    trace::Phase phase("save_box");
+    std::string path = Sandbox::box_base_path(box_root, s->get_id()) + "boxinfo";
+    try {
+        // Long running processes keep the box in memory and save it after
+        // every command, so they skip the flush to disk.
+        write_box_info(path, *s, !box_cache_enabled);
+        struct stat info;
+        if (box_cache_enabled && stat(path.c_str(), &info) == 0) box_cache[path] = {s, info};
+    } catch (std::exception& e) {
+        box_cache.erase(path);
+        logger->error(3, std::string("Error saving the sandbox: ") + e.what());
+    }
+}
+
+namespace commands {
+
+#define TEST_FEATURE(feature) if (features & Sandbox::feature) std::get<2>(res.back()).emplace_back(#feature);
+void list(const std::string& box_root) {
+    std::vector<std::tuple<std::string, int, std::vector<std::string>>> res;
+    for (const auto& creator: *box_creators) {
+        std::unique_ptr<Sandbox> s(creator.second(box_root));
+        attach_logger(s.get());
+        if (!s->is_available()) continue;
+        res.emplace_back(creator.first, s->get_overhead(), std::vector<std::string>{});
+        Sandbox::feature_mask_t features = s->get_features();
+        TEST_FEATURE(memory_limit);
+        TEST_FEATURE(cpu_limit);
+        TEST_FEATURE(wall_time_limit);
+        TEST_FEATURE(process_limit);
+        TEST_FEATURE(process_limit_full);
+        TEST_FEATURE(disk_limit);
+        TEST_FEATURE(disk_limit_full);
+        TEST_FEATURE(folder_mount);
+        TEST_FEATURE(memory_usage);
+        TEST_FEATURE(running_time);
+        TEST_FEATURE(wall_time);
+        TEST_FEATURE(clearable);
+        TEST_FEATURE(process_isolation);
+        TEST_FEATURE(io_redirection);
+        TEST_FEATURE(network_isolation);
+        TEST_FEATURE(return_code);
+        TEST_FEATURE(signal);
+        TEST_FEATURE(cpu_affinity);
+        TEST_FEATURE(perf_counters);
+        TEST_FEATURE(fd_redirection);
+        TEST_FEATURE(output_check);
+        TEST_FEATURE(cancellable);
+        TEST_FEATURE(syscall_filter);
+        TEST_FEATURE(file_import);
+        TEST_FEATURE(file_export);
+    }
+    logger->result(res);
+}
+#undef TEST_FEATURE
+
+void create(const std::string& box_root, const std::string& box_type) {
+    if (!box_creators->count(box_type)) {
+        logger->error(2, "The given box type does not exist!");
+        return;
+    }
+    auto box_creator = (*box_creators)[box_type];
+    std::shared_ptr<Sandbox> s(box_creator(box_root));
+    attach_logger(s.get());
+    if (!s->is_available()) {
+        logger->error(2, "The given box type is not available!");
+        return;
+    }
+    s->create_box();
+    save_box(box_root, s);
+    logger->result(s->get_id());
+}
+
+void check(const std::string& box_root, const std::string& box_id) {
+    auto s = load_box(box_root, box_id);
+    logger->result(s.get() == nullptr ? false : s->check());
+}
+
+void get_root(const std::string& box_root, const std::string& box_id) {
+    auto s = load_box(box_root, box_id);
+    logger->result(s.get() == nullptr ? "" : s->get_root());
+}
+
+void cpu_limit(const std::string& box_root, const std::string& box_id) {
+    auto s = load_box(box_root, box_id);
+    logger->result(s.get() == nullptr ? 0 : s->get_time_limit());
+}
+
+void cpu_limit(const std::string& box_root, const std::string& box_id, time_limit_t value) {
+    auto s = load_box(box_root, box_id);
+    logger->result(s.get() == nullptr ? false : s->set_time_limit(value));
+    save_box(box_root, s);
+}
+
+void wall_limit(const std::string& box_root, const std::string& box_id) {
+    auto s = load_box(box_root, box_id);
+    logger->result(s.get() == nullptr ? 0 : s->get_wall_time_limit());
+}
+
+void wall_limit(const std::string& box_root, const std::string& box_id, time_limit_t value) {
+    auto s = load_box(box_root, box_id);
+    logger->result(s.get() == nullptr ? false : s->set_wall_time_limit(value));
+    save_box(box_root, s);
+}
+
+void memory_limit(const std::string& box_root, const std::string& box_id) {
+    auto s = load_box(box_root, box_id);
+    logger->result(s.get() == nullptr ? 0 : s->get_memory_limit());
+}
+
+void memory_limit(const std::string& box_root, const std::string& box_id, space_limit_t value) {
+    auto s = load_box(box_root, box_id);
+    logger->result(s.get() == nullptr ? false : s->set_memory_limit(value));
+    save_box(box_root, s);
+}
+
+void disk_limit(const std::string& box_root, const std::string& box_id) {
+    auto s = load_box(box_root, box_id);
+    logger->result(s.get() == nullptr ? 0 : s->get_disk_limit());
+}
+
+void disk_limit(const std::string& box_root, const std::string& box_id, space_limit_t value) {
+    auto s = load_box(box_root, box_id);
+    logger->result(s.get() == nullptr ? false : s->set_disk_limit(value));
+    save_box(box_root, s);
+}
+
+void process_limit(const std::string& box_root, const std::string& box_id) {
+    auto s = load_box(box_root, box_id);
+    logger->result(s.get() == nullptr ? 0 : s->get_process_limit());
+}
+
+void process_limit(const std::string& box_root, const std::string& box_id, int value) {
+    auto s = load_box(box_root, box_id);
+    logger->result(s.get() == nullptr ? false : s->set_process_limit(value));
+    save_box(box_root, s);
+}
+
+void perf_counters(const std::string& box_root, const std::string& box_id) {
+    auto s = load_box(box_root, box_id);
+    logger->result(s.get() == nullptr ? false : s->get_perf_counters());
+}
+
+void perf_counters(const std::string& box_root, const std::string& box_id, bool value) {
+    auto s = load_box(box_root, box_id);
+    logger->result(s.get() == nullptr ? false : s->set_perf_counters(value));
+    save_box(box_root, s);
+}
+
+void instruction_limit(const std::string& box_root, const std::string& box_id) {
+    auto s = load_box(box_root, box_id);
+    logger->result(s.get() == nullptr ? 0 : s->get_instruction_limit());
+}
+
+void instruction_limit(const std::string& box_root, const std::string& box_id, uint64_t value) {
+    auto s = load_box(box_root, box_id);
+    logger->result(s.get() == nullptr ? false : s->set_instruction_limit(value));
+    save_box(box_root, s);
+}
+
+void redirect(const std::string& box_root, const std::string& box_id, const std::string& stream) {
+    auto s = load_box(box_root, box_id);
+    if (s.get() == nullptr) {
+        logger->result("");
+        return;
+    }
+    if (stream == "stdin") {
+        logger->result(s->get_stdin());
+    } else if (stream == "stdout") {
+        logger->result(s->get_stdout());
+    } else if (stream == "stderr") {
+        logger->result(s->get_stderr());
+    } else {
+        logger->error(2, "Invalid redirect type given");
+        logger->result(false);
+    }
+}
+
+void redirect(const std::string& box_root, const std::string& box_id, const std::string& stream, std::string value) {
+    auto s = load_box(box_root, box_id);
+    if (s.get() == nullptr) {
+        logger->result(false);
+        return;
+    }
+    if (value == "-") value = "";
+    if (!resolve_passed_fd(value)) {
+        logger->result(false);
+        return;
+    }
+    if (stream == "stdin") {
+        logger->result(s->redirect_stdin(value));
+    } else if (stream == "stdout") {
+        logger->result(s->redirect_stdout(value));
+    } else if (stream == "stderr") {
+        logger->result(s->redirect_stderr(value));
+    } else {
+        logger->error(2, "Invalid redirect type given");
+        logger->result(false);
+    }
+    save_box(box_root, s);
+}
+
+void output_limit(const std::string& box_root, const std::string& box_id) {
+    auto s = load_box(box_root, box_id);
+    logger->result(s.get() == nullptr ? 0 : s->get_output_limit());
+}
+
+void output_limit(const std::string& box_root, const std::string& box_id, space_limit_t value) {
+    auto s = load_box(box_root, box_id);
+    logger->result(s.get() == nullptr ? false : s->set_output_limit(value));
+    save_box(box_root, s);
+}
+
+void syscall_profile(const std::string& box_root, const std::string& box_id) {
+    auto s = load_box(box_root, box_id);
+    logger->result(s.get() == nullptr ? "" : s->get_syscall_profile());
+}
+
+void syscall_profile(const std::string& box_root, const std::string& box_id, const std::string& profile) {
+    auto s = load_box(box_root, box_id);
+    logger->result(s.get() == nullptr ? false : s->set_syscall_profile(profile));
+    save_box(box_root, s);
+}
+
+void output(const std::string& box_root, const std::string& box_id, const std::string& stream) {
+    auto s = load_box(box_root, box_id);
+    int fd = s.get() == nullptr ? -1 : s->get_output_fd(stream);
+    std::string data;
+    char buf[1 << 16];
+    ssize_t nread;
+    while (fd != -1 && (nread = pread(fd, buf, sizeof buf, data.size())) != 0) {
+        if (nread == -1 && errno == EINTR) continue;
+        if (nread == -1) {
+            logger->error(4, serror("Error reading the " + stream));
+            break;
+        }
+        data.append(buf, nread);
+    }
+    logger->result(data);
+}
+
+void export_files(const std::string& box_root, const std::string& box_id, const std::vector<std::string>& patterns,
+    const std::string& dest, space_limit_t max_size) {
+    auto s = load_box(box_root, box_id);
+    bool owned;
+    int fd = s.get() == nullptr ? -1 : open_export_destination(dest, owned);
+    if (fd == -1) {
+        logger->result(std::vector<ExportedFile>{});
+        return;
+    }
+    // A reader that goes away makes the export fail instead of killing us.
+    // SIGPIPE is only blocked in this thread and for the export, so that the
+    // programs run later still get it.
+    sigset_t pipe_mask, saved_mask;
+    sigemptyset(&pipe_mask);
+    sigaddset(&pipe_mask, SIGPIPE);
+    pthread_sigmask(SIG_BLOCK, &pipe_mask, &saved_mask);
+    logger->result(s->export_files(patterns, fd, max_size));
+    if (!sigismember(&saved_mask, SIGPIPE)) {
+        struct timespec no_wait = {0, 0};
+        while (sigtimedwait(&pipe_mask, nullptr, &no_wait) == SIGPIPE);
+    }
+    pthread_sigmask(SIG_SETMASK, &saved_mask, nullptr);
+    if (owned) close(fd);
+}
+
+void output_check(const std::string& box_root, const std::string& box_id) {
+    auto s = load_box(box_root, box_id);
+    logger->result(s.get() == nullptr ? "" : s->get_output_check());
+}
+
+void output_check(const std::string& box_root, const std::string& box_id, const std::string& expected_path,
+    const std::string& mode, double tolerance) {
+    auto s = load_box(box_root, box_id);
+    logger->result(s.get() == nullptr ? false : s->set_output_check(expected_path, mode, tolerance));
+    save_box(box_root, s);
+}
+
+void root_fs(const std::string& box_root, const std::string& box_id) {
+    auto s = load_box(box_root, box_id);
+    logger->result(s.get() == nullptr ? "" : s->get_root_fs());
+}
+
+void root_fs(const std::string& box_root, const std::string& box_id, const std::string& type,
+    const std::string& lower_path) {
+    auto s = load_box(box_root, box_id);
+    logger->result(s.get() == nullptr ? false : s->set_root_fs(type, lower_path));
+    save_box(box_root, s);
+}
+
+void mount(const std::string& box_root, const std::string& box_id, const std::string& inner_path) {
+    auto s = load_box(box_root, box_id);
+    logger->result(s.get() == nullptr ? "" : s->mount(inner_path));
+}
+
+void mount(const std::string& box_root, const std::string& box_id, const std::string& inner_path,
+    const std::string& outer_path, bool rw) {
+    auto s = load_box(box_root, box_id);
+    logger->result(s.get() == nullptr ? false : s->mount(inner_path, outer_path, rw));
+    save_box(box_root, s);
+}
+
+void umount(const std::string& box_root, const std::string& box_id, const std::string& inner_path) {
+    auto s = load_box(box_root, box_id);
+    logger->result(s.get() == nullptr ? false : s->umount(inner_path));
+    save_box(box_root, s);
+}
+
+void import(const std::string& box_root, const std::string& box_id, const std::string& inner_path,
+    const std::string& outer_path, bool rw) {
+    auto s = load_box(box_root, box_id);
+    logger->result(s.get() == nullptr ? false : s->import_file(inner_path, outer_path, rw));
+}
+
+void run(const std::string& box_root, const std::string& box_id, const std::string& exec,
+    const std::vector<std::string>& args) {
+    trace::Phase phase("run");
+    auto s = load_box(box_root, box_id);
+    if (s.get() == nullptr) {
+        logger->result(RunResult());
+        return;
+    }
+    bool success = pin_box(s) && s->run(exec, args);
+    RunResult res = s->get_run_result();
+    res.success = success;
+    logger->result(res);
+    save_box(box_root, s);
+}
+
+void run_many(const std::string& box_root, const std::string& box_id, const std::string& exec,
+    const std::vector<std::string>& args, const std::vector<std::pair<std::string, std::string>>& cases) {
+    trace::Phase phase("run_many");
+    auto s = load_box(box_root, box_id);
+    if (s.get() == nullptr) {
+        logger->result(std::vector<RunResult>());
+        return;
+    }
+    auto resolved_cases = cases;
+    for (auto& io: resolved_cases) {
+        if (!resolve_passed_fd(io.first) || !resolve_passed_fd(io.second)) {
+            logger->result(std::vector<RunResult>());
+            return;
+        }
+    }
+    logger->result(pin_box(s) ? s->run_many(exec, args, resolved_cases) : std::vector<RunResult>());
+    save_box(box_root, s);
+}
+
+void run_interactive(const std::string& box_root, const std::string& box_id, const std::string& exec,
+    const std::vector<std::string>& args, const std::string& manager_id, const std::string& manager_exec,
+    const std::vector<std::string>& manager_args) {
+    trace::Phase phase("run_interactive");
+    std::vector<RunResult> results;
+    InteractiveRun runs[2];
+    runs[0] = {load_box(box_root, box_id), exec, args};
+    runs[1] = {load_box(box_root, manager_id), manager_exec, manager_args};
+    if (runs[0].box.get() == nullptr || runs[1].box.get() == nullptr) {
+        logger->result(results);
+        return;
+    }
+    if (runs[0].box->get_id() == runs[1].box->get_id()) {
+        logger->error(2, "The program and the manager must run in different boxes");
+        logger->result(results);
+        return;
+    }
+    for (const auto& run: runs) {
+        auto needed = Sandbox::fd_redirection | Sandbox::cancellable;
+        if ((run.box->get_features() & needed) != needed) {
+            logger->error(254, "This sandbox cannot run interactive programs!");
+            logger->result(results);
+            return;
+        }
+    }
+    // The program writes to the manager and the manager to the program. The
+    // cancel pipe stops both programs when one of them fails.
+    int to_manager[2] = {-1, -1}, to_program[2] = {-1, -1}, cancel[2] = {-1, -1};
+    if (!open_pipe(to_manager) || !open_pipe(to_program) || !open_pipe(cancel)) {
+        close_pipe(to_manager);
+        close_pipe(to_program);
+        close_pipe(cancel);
+        logger->result(results);
+        return;
+    }
+    bool started = start_interactive(box_root, runs[0], to_program[0], to_manager[1], cancel[0],
+        {to_program[1], to_manager[0], cancel[1]});
+    started = started && start_interactive(box_root, runs[1], to_manager[0], to_program[1], cancel[0],
+        {to_manager[1], to_program[0], cancel[1]});
+    close_pipe(to_manager);
+    close_pipe(to_program);
+    if (!started) write(cancel[1], "", 1);
+    std::vector<RunResult> finished(2);
+    size_t running = runs[0].sock != -1 ? 1 + (runs[1].sock != -1) : 0;
+    while (running > 0) {
+        struct pollfd fds[2] = {{runs[0].sock, POLLIN, 0}, {runs[1].sock, POLLIN, 0}};
+        if (poll(fds, 2, -1) == -1) {
+            if (errno == EINTR) continue;
+            logger->error(4, serror("poll"));
+            write(cancel[1], "", 1);
+            break;
+        }
+        for (int i=0; i<2; i++) {
+            if (fds[i].revents == 0) continue;
+            char buf[4096];
+            ssize_t nread = read(runs[i].sock, buf, sizeof buf);
+            if (nread > 0) runs[i].reply.append(buf, nread);
+            if (nread > 0 || (nread == -1 && errno == EINTR)) continue;
+            finished[i] = finish_interactive(runs[i]);
+            running--;
+            // A program that fails takes the other down.
+            if (finished[i].status != "Terminated normally" || finished[i].return_code != 0)
+                write(cancel[1], "", 1);
+        }
+    }
+    for (auto& run: runs)
+        if (run.sock != -1) finished[&run - runs] = finish_interactive(run);
+    close_pipe(cancel);
+    logger->result(finished);
+}
+
+void running_time(const std::string& box_root, const std::string& box_id) {
+    auto s = load_box(box_root, box_id);
+    logger->result(s.get() == nullptr ? time_limit_t(0) : s->get_running_time());
+}
+
+void wall_time(const std::string& box_root, const std::string& box_id) {
+    auto s = load_box(box_root, box_id);
+    logger->result(s.get() == nullptr ? time_limit_t(0) : s->get_wall_time());
+}
+
+void memory_usage(const std::string& box_root, const std::string& box_id) {
+    auto s = load_box(box_root, box_id);
+    logger->result(s.get() == nullptr ? space_limit_t(0) : s->get_memory_usage());
+}
+
+void status(const std::string& box_root, const std::string& box_id) {
+    auto s = load_box(box_root, box_id);
+    logger->result(s.get() == nullptr ? "" : s->get_status());
+}
+
+void return_code(const std::string& box_root, const std::string& box_id) {
+    auto s = load_box(box_root, box_id);
+    logger->result(s.get() == nullptr ? 0 : s->get_return_code());
+}
+
+void signal(const std::string& box_root, const std::string& box_id) {
+    auto s = load_box(box_root, box_id);
+    logger->result(s.get() == nullptr ? 0 : s->get_signal());
+}
+
+void run_result(const std::string& box_root, const std::string& box_id) {
+    auto s = load_box(box_root, box_id);
+    logger->result(s.get() == nullptr ? RunResult() : s->get_run_result());
+}
+
+void clear(const std::string& box_root, const std::string& box_id) {
+    auto s = load_box(box_root, box_id);
+    logger->result(s.get() == nullptr ? false : s->clear());
+    save_box(box_root, s);
+}
+
+void destroy(const std::string& box_root, const std::string& box_id) {
+    auto s = load_box(box_root, box_id);
+    logger->result(s.get() == nullptr ? false : s->delete_box());
+    if (s.get() != nullptr) box_cache.erase(Sandbox::box_base_path(box_root, s->get_id()) + "boxinfo");
+}
+
+namespace {
+typedef std::function<void(const std::string&, const std::string&, const json_value&)> json_command_t;
+
+std::string box_id_of(const json_value& cmd) {
+    const json_value& box = cmd["box"];
+    if (box.is_number()) return std::to_string((long long)box.as_number());
+    return box.as_string();
+}
+
+std::string string_field(const json_value& cmd, const std::string& field) {
+    return cmd[field].as_string();
+}
+
+#define GETTER_SETTER(name, type) {#name, [](const std::string& root, const std::string& id, const json_value& cmd) { \
+    if (cmd.has("value")) name(root, id, type(cmd["value"].as_number())); \
+    else name(root, id); \
+}}
+#define GETTER(name) {#name, [](const std::string& root, const std::string& id, const json_value& cmd) { \
+    name(root, id); \
+}}
+const std::map<std::string, json_command_t> json_commands = {
+    GETTER(check),
+    GETTER(get_root),
+    GETTER_SETTER(cpu_limit, time_limit_t),
+    GETTER_SETTER(wall_limit, time_limit_t),
+    GETTER_SETTER(memory_limit, space_limit_t),
+    GETTER_SETTER(disk_limit, space_limit_t),
+    GETTER_SETTER(process_limit, int),
+    GETTER_SETTER(instruction_limit, uint64_t),
+    GETTER_SETTER(output_limit, space_limit_t),
+    {"output", [](const std::string& root, const std::string& id, const json_value& cmd) {
+        output(root, id, string_field(cmd, "stream"));
+    }},
+    {"export", [](const std::string& root, const std::string& id, const json_value& cmd) {
+        std::vector<std::string> patterns;
+        for (const auto& pattern: cmd["files"].as_array()) patterns.push_back(pattern.as_string());
+        export_files(root, id, patterns, string_field(cmd, "to"),
+            cmd.has("max_size") ? space_limit_t(cmd["max_size"].as_number()) : space_limit_t(0));
+    }},
+    {"output_check", [](const std::string& root, const std::string& id, const json_value& cmd) {
+        if (!cmd.has("value")) output_check(root, id);
+        else output_check(root, id, string_field(cmd, "value"), cmd.has("mode") ? string_field(cmd, "mode") : "exact",
+            cmd.has("tolerance") ? cmd["tolerance"].as_number() : 0);
+    }},
+    {"syscall_profile", [](const std::string& root, const std::string& id, const json_value& cmd) {
+        if (cmd.has("value")) syscall_profile(root, id, string_field(cmd, "value"));
+        else syscall_profile(root, id);
+    }},
+    {"perf_counters", [](const std::string& root, const std::string& id, const json_value& cmd) {
+        if (cmd.has("value")) perf_counters(root, id, cmd["value"].as_bool());
+        else perf_counters(root, id);
+    }},
+    {"redirect", [](const std::string& root, const std::string& id, const json_value& cmd) {
+        if (cmd.has("value")) redirect(root, id, string_field(cmd, "stream"), string_field(cmd, "value"));
+        else redirect(root, id, string_field(cmd, "stream"));
+    }},
+    {"root_fs", [](const std::string& root, const std::string& id, const json_value& cmd) {
+        if (!cmd.has("value")) root_fs(root, id);
+        else if (cmd.has("external_path")) root_fs(root, id, string_field(cmd, "value"), string_field(cmd, "external_path"));
+        else root_fs(root, id, string_field(cmd, "value"), "");
+    }},
+    {"mount", [](const std::string& root, const std::string& id, const json_value& cmd) {
+        if (cmd.has("external_path")) {
+            bool rw = cmd.has("rw") && cmd["rw"].as_bool();
+            mount(root, id, string_field(cmd, "internal_path"), string_field(cmd, "external_path"), rw);
+        } else {
+            mount(root, id, string_field(cmd, "internal_path"));
+        }
+    }},
+    {"umount", [](const std::string& root, const std::string& id, const json_value& cmd) {
+        umount(root, id, string_field(cmd, "internal_path"));
+    }},
+    {"import", [](const std::string& root, const std::string& id, const json_value& cmd) {
+        bool rw = cmd.has("rw") && cmd["rw"].as_bool();
+        import(root, id, string_field(cmd, "internal_path"), string_field(cmd, "external_path"), rw);
+    }},
+    {"run", [](const std::string& root, const std::string& id, const json_value& cmd) {
+        std::vector<std::string> args;
+        if (cmd.has("args"))
+            for (const auto& arg: cmd["args"].as_array()) args.push_back(arg.as_string());
+        run(root, id, string_field(cmd, "exec"), args);
+    }},
+    {"run_many", [](const std::string& root, const std::string& id, const json_value& cmd) {
+        std::vector<std::string> args;
+        if (cmd.has("args"))
+            for (const auto& arg: cmd["args"].as_array()) args.push_back(arg.as_string());
+        std::vector<std::pair<std::string, std::string>> cases;
+        for (const auto& io: cmd["cases"].as_array())
+            cases.emplace_back(io.as_array().at(0).as_string(), io.as_array().at(1).as_string());
+        run_many(root, id, string_field(cmd, "exec"), args, cases);
+    }},
+    {"run_interactive", [](const std::string& root, const std::string& id, const json_value& cmd) {
+        std::vector<std::string> args, manager_args;
+        if (cmd.has("args"))
+            for (const auto& arg: cmd["args"].as_array()) args.push_back(arg.as_string());
+        if (cmd.has("manager_args"))
+            for (const auto& arg: cmd["manager_args"].as_array()) manager_args.push_back(arg.as_string());
+        const json_value& manager = cmd["manager_box"];
+        std::string manager_id = manager.is_number() ? std::to_string((long long)manager.as_number()) :
+            manager.as_string();
+        run_interactive(root, id, string_field(cmd, "exec"), args, manager_id, string_field(cmd, "manager_exec"),
+            manager_args);
+    }},
+    GETTER(running_time),
+    GETTER(wall_time),
+    GETTER(memory_usage),
+    GETTER(status),
+    GETTER(return_code),
+    GETTER(signal),
+    GETTER(run_result),
+    GETTER(clear),
+    GETTER(destroy)
+};
+#undef GETTER
+#undef GETTER_SETTER
+}
+
+void execute(const std::string& box_root, const json_value& cmd) {
+    if (!cmd.is_object()) throw std::runtime_error("The command must be a JSON object");
+    std::string name = string_field(cmd, "cmd");
+    std::replace(name.begin(), name.end(), '-', '_');
+    if (name == "list") {
+        list(box_root);
+        return;
+    }
+    if (name == "create") {
+        create(box_root, string_field(cmd, "box_type"));
+        return;
+    }
+    auto command = json_commands.find(name);
+    if (command == json_commands.end()) {
+        logger->error(2, "Unknown command " + name);
+        return;
+    }
+    if (!cmd.has("box")) {
+        logger->error(2, "You need to specify a box id!");
+        return;
+    }
+    command->second(box_root, box_id_of(cmd), cmd);
+}
+
+} // namespace commands
@@ -0,0 +1,63 @@
+#include "util.hpp"
+#ifdef COTTON_LINUX
+#include "cpu_pool.hpp"
+#include <algorithm>
+#include <fstream>
+#include <sched.h>
+
+namespace {
+// Parses a cpu list as in sysfs, e.g. "0-3,8".
+std::vector<int> parse_cpu_list(const std::string& list) {
+    std::vector<int> cpus;
+    size_t pos = 0;
+    while (pos < list.size()) {
+        size_t end = list.find(',', pos);
+        if (end == std::string::npos) end = list.size();
+        std::string range = list.substr(pos, end - pos);
+        size_t dash = range.find('-');
+        int first = atoi(range.c_str());
+        int last = dash == std::string::npos ? first : atoi(range.c_str() + dash + 1);
+        for (int cpu = first; cpu <= last; cpu++) cpus.push_back(cpu);
+        pos = end + 1;
+    }
+    return cpus;
+}
+
+std::vector<int> thread_siblings(int cpu) {
+    std::ifstream fin("/sys/devices/system/cpu/cpu" + std::to_string(cpu) + "/topology/thread_siblings_list");
+    std::string list;
+    if (!(fin >> list)) return {cpu};
+    return parse_cpu_list(list);
+}
+}
+
+CpuPool::CpuPool() {
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    if (sched_getaffinity(0, sizeof allowed, &allowed) == -1) return;
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        if (!CPU_ISSET(cpu, &allowed)) continue;
+        // Use only the first allowed thread of every core.
+        bool first = true;
+        for (int sibling: thread_siblings(cpu))
+            if (sibling < cpu && sibling >= 0 && sibling < CPU_SETSIZE && CPU_ISSET(sibling, &allowed))
+                first = false;
+        if (first) free_cpus.push_back(cpu);
+    }
+    size_ = free_cpus.size();
+    // Hand out the lowest cpus first.
+    std::reverse(free_cpus.begin(), free_cpus.end());
+}
+
+int CpuPool::acquire() {
+    if (free_cpus.empty()) return -1;
+    int cpu = free_cpus.back();
+    free_cpus.pop_back();
+    return cpu;
+}
+
+void CpuPool::release(int cpu) {
+    if (cpu != -1) free_cpus.push_back(cpu);
+}
+
+#endif
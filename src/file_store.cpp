@@ -0,0 +1,211 @@
+#include "util.hpp"
+#ifdef COTTON_UNIX
+#include "file_store.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <boost/uuid/detail/sha1.hpp>
+#ifdef COTTON_LINUX
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#endif
+
+namespace {
+const size_t chunk = 1 << 20;
+const mode_t dir_mode = S_IRWXU | S_IRGRP | S_IXGRP | S_IROTH | S_IXOTH;
+const mode_t exec_mode = S_IXUSR | S_IXGRP | S_IXOTH;
+const mode_t read_only_mode = S_IRUSR | S_IRGRP | S_IROTH;
+
+// The digest is made of words up to boost 1.85, and of bytes after it.
+template <typename Word, size_t N> std::string to_hex(const Word (&digest)[N]) {
+    std::string hex;
+    char buf[9];
+    for (size_t i=0; i<N; i++) {
+        snprintf(buf, sizeof buf, "%0*x", (int)(2 * sizeof(Word)), (unsigned)digest[i]);
+        hex += buf;
+    }
+    return hex;
+}
+
+bool hash_file(int fd, size_t size, std::string& hash) {
+    boost::uuids::detail::sha1 sha;
+    std::vector<char> buf(chunk);
+    size_t done = 0;
+    while (done < size) {
+        ssize_t nread = pread(fd, buf.data(), std::min(chunk, size - done), done);
+        if (nread == -1 && errno == EINTR) continue;
+        if (nread == -1) return false;
+        if (nread == 0) {
+            errno = EAGAIN; // Truncated in the meantime
+            return false;
+        }
+        sha.process_bytes(buf.data(), nread);
+        done += nread;
+    }
+    boost::uuids::detail::sha1::digest_type digest;
+    sha.get_digest(digest);
+    hash = to_hex(digest);
+    return true;
+}
+
+// Changes whenever the content of the file may have changed.
+std::string inode_key(const struct stat& st) {
+    char buf[160];
+    snprintf(buf, sizeof buf, "%llx-%llx-%llx-%lld.%09ld-%lld.%09ld", (unsigned long long)st.st_dev,
+        (unsigned long long)st.st_ino, (unsigned long long)st.st_size, (long long)st.st_mtim.tv_sec,
+        (long)st.st_mtim.tv_nsec, (long long)st.st_ctim.tv_sec, (long)st.st_ctim.tv_nsec);
+    return buf;
+}
+
+// Closes the descriptors keeping errno.
+void close_all(std::initializer_list<int> fds) {
+    int err = errno;
+    for (int fd: fds)
+        if (fd != -1) close(fd);
+    errno = err;
+}
+}
+
+std::string FileStore::add(const std::string& source) {
+    int fd = open(source.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd == -1) return "";
+    struct stat st;
+    if (fstat(fd, &st) == -1) {
+        close_all({fd});
+        return "";
+    }
+    if (!S_ISREG(st.st_mode)) {
+        close(fd);
+        errno = EINVAL;
+        return "";
+    }
+    std::string key = inodes_path() + inode_key(st);
+    char target[64];
+    ssize_t len = readlink(key.c_str(), target, sizeof target - 1);
+    struct stat stored_st;
+    if (len > 0) {
+        target[len] = 0;
+        std::string stored = objects_path() + target;
+        if (stat(stored.c_str(), &stored_st) == 0) {
+            close(fd);
+            return stored;
+        }
+    }
+    std::string name;
+    if (!hash_file(fd, st.st_size, name)) {
+        close_all({fd});
+        return "";
+    }
+    if (st.st_mode & exec_mode) name += "-x";
+    std::string stored = objects_path() + name;
+    // The store is not writable by the programs in the boxes.
+    Privileged p;
+    if (stat(stored.c_str(), &stored_st) == -1) {
+        if (mkdirs(objects_path(), dir_mode) == -1 || mkdirs(tmp_path(), dir_mode) == -1) {
+            close_all({fd});
+            return "";
+        }
+        std::string tmp = tmp_path() + "XXXXXX";
+        int tmp_fd = mkstemp(&tmp[0]);
+        if (tmp_fd == -1) {
+            close_all({fd});
+            return "";
+        }
+        struct stat after;
+        bool ok = copy_data(fd, tmp_fd, st.st_size) &&
+            fchmod(tmp_fd, read_only_mode | (st.st_mode & exec_mode)) == 0 && fstat(fd, &after) == 0;
+        if (ok && inode_key(after) != inode_key(st)) {
+            errno = EAGAIN; // Modified while it was hashed or copied
+            ok = false;
+        }
+        ok = ok && (link(tmp.c_str(), stored.c_str()) == 0 || errno == EEXIST);
+        close_all({fd, tmp_fd});
+        int err = errno;
+        unlink(tmp.c_str());
+        errno = err;
+        if (!ok) return "";
+    } else {
+        close(fd);
+    }
+    // Remembered only once the stored file exists, replacing a stale link.
+    if (mkdirs(inodes_path(), dir_mode) == 0 && mkdirs(tmp_path(), dir_mode) == 0) {
+        std::string tmp_key = tmp_path() + inode_key(st) + "." + std::to_string(getpid());
+        if (symlink(name.c_str(), tmp_key.c_str()) == 0 && rename(tmp_key.c_str(), key.c_str()) == -1)
+            unlink(tmp_key.c_str());
+    }
+    return stored;
+}
+
+bool FileStore::place(const std::string& stored, int dir_fd, const std::string& name, bool writable) {
+    struct stat st;
+    if (stat(stored.c_str(), &st) == -1) return false;
+    // The owner of the stored file, or root, could write to it through the
+    // link.
+    if (!writable && st.st_uid != geteuid() && geteuid() != 0) {
+        Privileged p;
+        if (linkat(AT_FDCWD, stored.c_str(), dir_fd, name.c_str(), 0) == 0) return true;
+        if (errno != EXDEV && errno != EMLINK && errno != EPERM) return false;
+    }
+    int from = open(stored.c_str(), O_RDONLY | O_CLOEXEC);
+    if (from == -1) return false;
+    mode_t mode = st.st_mode & (read_only_mode | exec_mode);
+    if (writable) mode |= S_IWUSR;
+    int to = openat(dir_fd, name.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_NOFOLLOW | O_CLOEXEC, mode);
+    if (to == -1) {
+        close_all({from});
+        return false;
+    }
+    bool ok = copy_data(from, to, st.st_size);
+    close_all({from, to});
+    if (!ok) {
+        int err = errno;
+        unlinkat(dir_fd, name.c_str(), 0);
+        errno = err;
+    }
+    return ok;
+}
+
+bool FileStore::copy_data(int from, int to, size_t size) {
+    size_t done = 0;
+#ifdef COTTON_LINUX
+    if (ioctl(to, FICLONE, from) == 0) return true;
+    // Copied by the kernel, or offloaded to the storage.
+    loff_t offset = 0;
+    while (done < size) {
+        ssize_t copied = copy_file_range(from, &offset, to, nullptr, size - done, 0);
+        if (copied == -1 && errno == EINTR) continue;
+        if (copied == -1 && done == 0 && (errno == EXDEV || errno == EINVAL || errno == ENOSYS ||
+            errno == EOPNOTSUPP)) break;
+        if (copied == -1) return false;
+        if (copied == 0) {
+            errno = EAGAIN; // Truncated in the meantime
+            return false;
+        }
+        done += copied;
+    }
+#endif
+    std::vector<char> buf(std::min(chunk, size - done));
+    while (done < size) {
+        ssize_t nread = pread(from, buf.data(), std::min(chunk, size - done), done);
+        if (nread == -1 && errno == EINTR) continue;
+        if (nread == -1) return false;
+        if (nread == 0) {
+            errno = EAGAIN;
+            return false;
+        }
+        for (ssize_t written = 0; written < nread; ) {
+            ssize_t n = write(to, buf.data() + written, nread - written);
+            if (n == -1 && errno == EINTR) continue;
+            if (n == -1) return false;
+            written += n;
+        }
+        done += nread;
+    }
+    return true;
+}
+
+#endif
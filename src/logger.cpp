@@ -1,6 +1,25 @@
 #include "logger.hpp"
 #include <iostream>
 
+namespace {
+json_raw_string run_result_to_json(const RunResult& res) {
+    return to_json_obj(
+        "success", res.success,
+        "status", res.status,
+        "return_code", res.return_code,
+        "signal", res.signal,
+        "running_time", res.running_time.double_seconds(),
+        "wall_time", res.wall_time.double_seconds(),
+        "memory_usage", res.memory_usage.kilobytes(),
+        "cpu", res.cpu,
+        "instructions", res.instructions,
+        "cycles", res.cycles,
+        "task_clock", res.task_clock.double_seconds(),
+        "verdict", res.verdict
+    );
+}
+}
+
 void CottonTTYLogger::error(int code, const std::string& error) {
     std::cerr << error_color << "Error " << code;
     std::cerr << reset_color << ": " << error << std::endl;
@@ -38,6 +57,39 @@ void CottonTTYLogger::result(const std::vector<std::tuple<std::string, int, std:
         std::cout << std::endl;
     }
 }
+void CottonTTYLogger::result(const RunResult& res) {
+    std::cout << "success: " << (res.success?"true":"false") << std::endl;
+    std::cout << "status: " << res.status << std::endl;
+    std::cout << "return code: " << res.return_code << std::endl;
+    std::cout << "signal: " << res.signal << std::endl;
+    std::cout << "running time: " << res.running_time.to_string() << std::endl;
+    std::cout << "wall time: " << res.wall_time.to_string() << std::endl;
+    std::cout << "memory usage: " << res.memory_usage.to_string() << std::endl;
+    if (res.cpu != -1) std::cout << "cpu: " << res.cpu << std::endl;
+    if (res.instructions != 0) {
+        std::cout << "instructions: " << res.instructions << std::endl;
+        std::cout << "cycles: " << res.cycles << std::endl;
+        std::cout << "task clock: " << res.task_clock.to_string() << std::endl;
+    }
+    if (!res.verdict.empty()) std::cout << "verdict: " << res.verdict << std::endl;
+}
+void CottonTTYLogger::result(const std::vector<RunResult>& res) {
+    for (unsigned i=0; i<res.size(); i++) {
+        std::cout << boxname_color << "case " << i << reset_color << std::endl;
+        result(res[i]);
+    }
+}
+void CottonTTYLogger::result(const std::vector<ExportedFile>& res) {
+    for (const auto& file: res) {
+        std::cout << file.path << ": " << file.size << " bytes";
+        if (file.truncated) std::cout << " (truncated)";
+        std::cout << std::endl;
+    }
+}
+void CottonTTYLogger::timings(const std::vector<std::pair<std::string, double>>& phases) {
+    for (const auto& phase: phases)
+        std::cerr << phase.first << ": " << phase.second << "us" << std::endl;
+}
 
 void CottonJSONLogger::error(int code, const std::string& error) {
     errors.emplace_back(code, error);
@@ -72,13 +124,40 @@ void CottonJSONLogger::result(const std::vector<std::tuple<std::string, int, std
         );
     });
 }
+void CottonJSONLogger::result(const RunResult& res) {
+    result_ = run_result_to_json(res);
+}
+void CottonJSONLogger::result(const std::vector<RunResult>& res) {
+    result_ = to_json_arr(res, run_result_to_json);
+}
+void CottonJSONLogger::result(const std::vector<ExportedFile>& res) {
+    result_ = to_json_arr(res, [](const ExportedFile& file) {
+        return to_json_obj(
+            "path", file.path,
+            "size", file.size,
+            "truncated", file.truncated
+        );
+    });
+}
+void CottonJSONLogger::timings(const std::vector<std::pair<std::string, double>>& phases) {
+    timings_ = to_json_obj(phases);
+}
 void CottonJSONLogger::write() {
     auto ew_converter = [] (const std::pair<int, std::string>& msg) {
         return to_json_obj("code", msg.first, "message", msg.second);
     };
-    std::cout << to_json_obj(
-        "result", result_,
-        "errors", to_json_arr(errors, ew_converter),
-        "warnings", to_json_arr(warnings, ew_converter)
-    ) << std::endl;
+    if (timings_.empty()) {
+        out << to_json_obj(
+            "result", result_,
+            "errors", to_json_arr(errors, ew_converter),
+            "warnings", to_json_arr(warnings, ew_converter)
+        ) << std::endl;
+    } else {
+        out << to_json_obj(
+            "result", result_,
+            "errors", to_json_arr(errors, ew_converter),
+            "warnings", to_json_arr(warnings, ew_converter),
+            "timings", timings_
+        ) << std::endl;
+    }
 }
@@ -1,5 +1,8 @@
 #include "box.hpp"
+#include "commands.hpp"
 #include "logger.hpp"
+#include "server.hpp"
+#include "trace.hpp"
 #include <vector>
 #include <fstream>
 #include "util.hpp"
@@ -27,32 +30,6 @@ void sig_handler(int sig) {
 }
 #endif
 
-std::unique_ptr<Sandbox> load_box(const std::string& box_root, const std::string& box_id) {
-    try {
-        std::ifstream fin(Sandbox::box_base_path(box_root, std::stoi(box_id)) + "boxinfo");
-        boost::archive::text_iarchive ia{fin};
-        Sandbox* s;
-        ia >> s;
-        s->set_error_handler(logger->get_error_function());
-        s->set_warning_handler(logger->get_warning_function());
-        return std::unique_ptr<Sandbox>(s);
-    } catch (std::exception& e) {
-        logger->error(3, std::string("Error loading the sandbox: ") + e.what());
-        return nullptr;
-    }
-}
-
-void save_box(const std::string& box_root, std::unique_ptr<Sandbox>& s) {
-    try {
-        std::ofstream fout(Sandbox::box_base_path(box_root, s->get_id()) + "boxinfo");
-        boost::archive::text_oarchive oa{fout};
-        Sandbox* ptr = s.get();
-        oa << ptr;
-    } catch (std::exception& e) {
-        logger->error(3, std::string("Error saving the sandbox: ") + e.what());
-    }
-}
-
 namespace program_options {
 
 template<>
@@ -72,11 +49,24 @@ DEFINE_OPTION(box_id, "id of the sandbox", 'b');
 DEFINE_OPTION(box_type, "type of the sandbox to be created");
 DEFINE_OPTION(value, "value to set");
 DEFINE_OPTION(stream, "the stream to operate on");
+DEFINE_OPTION(mode, "how to compare the output: exact, tokens or floats");
+DEFINE_OPTION(tolerance, "absolute or relative error allowed on numbers");
 DEFINE_OPTION(external_path, "path on the system");
 DEFINE_OPTION(internal_path, "path in the sandbox");
 DEFINE_OPTION(rw, "read-write");
 DEFINE_OPTION(exec, "executable to run");
 DEFINE_OPTION(arg, "arguments for the executable");
+DEFINE_OPTION(socket, "path of the unix socket");
+DEFINE_OPTION(file, "file to read commands from, - for standard input");
+DEFINE_OPTION(parallel, "run the programs in parallel, one per free physical core");
+DEFINE_OPTION(cases, "file with the stdin and the stdout of a run on each line, separated by a tab, - for none");
+DEFINE_OPTION(manager_box, "id of the sandbox of the manager");
+DEFINE_OPTION(manager, "manager to run in its sandbox, talking with the program");
+DEFINE_OPTION(files, "files of the sandbox, with the wildcards of glob");
+DEFINE_OPTION(to, "where to write: fd:N or the path of a unix socket");
+DEFINE_OPTION(max_size, "size after which each file is cut, 0 for none");
+DEFINE_OPTION(timings, "report how long each phase of the command took");
+DEFINE_OPTION(trace, "write the phases of the command to a file, in the Chrome trace format");
 
 DEFINE_COMMAND(list, "list available implementations");
 DEFINE_COMMAND(create, "create a sandbox",
@@ -93,32 +83,74 @@ DEFINE_COMMAND(disk_limit, "gets or sets the disk limit",
     positional<_value, space_limit_t, 0, 1>());
 DEFINE_COMMAND(process_limit, "gets or sets the process limit",
     positional<_value, int, 0, 1>());
-DEFINE_COMMAND(redirect, "gets or sets i/o redirections",
+DEFINE_COMMAND(perf_counters, "gets or sets whether to count instructions and cycles (1 or 0)",
+    positional<_value, int, 0, 1>());
+DEFINE_COMMAND(instruction_limit, "gets or sets the instruction limit, 0 for none",
+    positional<_value, const char*, 0, 1>());
+DEFINE_COMMAND(output_limit, "gets or sets the output limit of the streams redirected to descriptors or memfds",
+    positional<_value, space_limit_t, 0, 1>());
+DEFINE_COMMAND(output_check, "gets or sets the expected output to compare the stdout with, empty for none",
+    positional<_value, const char*, 0, 1>(),
+    positional<_mode, const char*, 0, 1>(),
+    positional<_tolerance, double, 0, 1>());
+DEFINE_COMMAND(syscall_profile, "gets or sets the syscalls allowed: program, python, compiler, or empty for all",
+    positional<_value, const char*, 0, 1>());
+DEFINE_COMMAND(redirect, "gets or sets i/o redirections: a file, fd:N or memfd",
     positional<_stream, const char*, 1>(),
     positional<_value, const char*, 0, 1>());
+DEFINE_COMMAND(root_fs, "gets or sets the filesystem of the sandbox root: dir, tmpfs or overlay",
+    positional<_value, const char*, 0, 1>(),
+    positional<_external_path, const char*, 0, 1>());
 DEFINE_COMMAND(mount, "enables paths in the sandbox, or gets information on a path",
     option<_rw, void>(),
     positional<_internal_path, const char*, 1>(),
     positional<_external_path, const char*, 0, 1>());
 DEFINE_COMMAND(umount, "disables paths in the sandbox",
     positional<_internal_path, const char*, 1>());
+DEFINE_COMMAND(import, "puts a file or a folder in the sandbox, sharing it with the other sandboxes",
+    option<_rw, void>(),
+    positional<_external_path, const char*, 1>(),
+    positional<_internal_path, const char*, 1>());
 DEFINE_COMMAND(run, "run program in the sandbox",
     positional<_exec, const char*, 1>(),
     positional<_arg, const char*, 0, 1000>());
+DEFINE_COMMAND(run_many, "run program in the sandbox once for every case",
+    option<_cases, const char*>(),
+    positional<_exec, const char*, 1>(),
+    positional<_arg, const char*, 0, 1000>());
+DEFINE_COMMAND(run_interactive, "run program in the sandbox and a manager in another one, connected by pipes",
+    option<_manager_box, const char*>(),
+    option<_manager, const char*>(),
+    positional<_exec, const char*, 1>(),
+    positional<_arg, const char*, 0, 1000>());
 DEFINE_COMMAND(running_time, "get last command's cpu time");
 DEFINE_COMMAND(wall_time, "get last command's wall time");
 DEFINE_COMMAND(memory_usage, "get last command's memory usage");
 DEFINE_COMMAND(status, "get last command's exit reason");
 DEFINE_COMMAND(return_code, "get last command's return code");
 DEFINE_COMMAND(signal, "get last command's killing signal");
+DEFINE_COMMAND(run_result, "get all the statistics of the last command");
+DEFINE_COMMAND(output, "get what the last command wrote to a stream redirected to memfd",
+    positional<_stream, const char*, 1>());
+DEFINE_COMMAND(export, "writes files of the sandbox, each one after a line with its size and its path",
+    option<_to, const char*>(),
+    option<_max_size, space_limit_t>(),
+    positional<_files, const char*, 1, 1000>());
 DEFINE_COMMAND(clear, "resets the sandbox to a clean state");
 DEFINE_COMMAND(destroy, "deletes the sandbox");
+DEFINE_COMMAND(serve, "keeps the sandboxes in memory and serves commands on a unix socket",
+    positional<_socket, const char*, 0, 1>());
+DEFINE_COMMAND(batch, "runs the JSON commands in a file, one per line",
+    option<_parallel, void>(),
+    positional<_file, const char*, 0, 1>());
 
 DEFINE_COMMAND(cotton, "Cotton sandbox",
     option<_help, void>(),
     option<_box_root, const char*>("/tmp"),
     option<_json, void>(),
     option<_box_id, const char*>(),
+    option<_timings, void>(),
+    option<_trace, const char*>(),
     &list_command,
     &create_command,
     &check_command,
@@ -128,18 +160,35 @@ DEFINE_COMMAND(cotton, "Cotton sandbox",
     &memory_limit_command,
     &disk_limit_command,
     &process_limit_command,
+    &perf_counters_command,
+    &instruction_limit_command,
+    &output_limit_command,
+    &output_check_command,
+    &syscall_profile_command,
     &redirect_command,
+    &root_fs_command,
     &mount_command,
     &umount_command,
+    &import_command,
     &run_command,
+    &run_many_command,
+    &run_interactive_command,
     &running_time_command,
     &wall_time_command,
     &memory_usage_command,
     &status_command,
     &return_code_command,
     &signal_command,
+    &run_result_command,
+    &output_command,
+    &export_command,
     &clear_command,
-    &destroy_command);
+    &destroy_command,
+    &serve_command,
+    &batch_command);
+
+bool report_timings = false;
+std::string trace_file;
 
 template<>
 void command_callback(const decltype(cotton_command)& cc) {
@@ -151,58 +200,19 @@ void command_callback(const decltype(cotton_command)& cc) {
         delete logger;
         logger = new CottonJSONLogger;
     }
+    report_timings = cc.has_option<_timings>();
+    if (cc.has_option<_trace>()) trace_file = cc.get_option<_trace>();
+    if (report_timings || !trace_file.empty()) trace::start();
 }
 
-#define TEST_FEATURE(feature) if (features & Sandbox::feature) std::get<2>(res.back()).emplace_back(#feature);
 template<>
 void command_callback(const decltype(cotton_command)& cc, const decltype(list_command)& lc) {
-    std::vector<std::tuple<std::string, int, std::vector<std::string>>> res;
-    for (const auto& creator: *box_creators) {
-        std::unique_ptr<Sandbox> s(creator.second(cc.get_option<_box_root>()));
-        s->set_error_handler(logger->get_error_function());
-        s->set_warning_handler(logger->get_warning_function());
-        if (!s->is_available()) continue;
-        res.emplace_back(creator.first, s->get_overhead(), std::vector<std::string>{});
-        Sandbox::feature_mask_t features = s->get_features();
-        TEST_FEATURE(memory_limit);
-        TEST_FEATURE(cpu_limit);
-        TEST_FEATURE(wall_time_limit);
-        TEST_FEATURE(process_limit);
-        TEST_FEATURE(process_limit_full);
-        TEST_FEATURE(disk_limit);
-        TEST_FEATURE(disk_limit_full);
-        TEST_FEATURE(folder_mount);
-        TEST_FEATURE(memory_usage);
-        TEST_FEATURE(running_time);
-        TEST_FEATURE(wall_time);
-        TEST_FEATURE(clearable);
-        TEST_FEATURE(process_isolation);
-        TEST_FEATURE(io_redirection);
-        TEST_FEATURE(network_isolation);
-        TEST_FEATURE(return_code);
-        TEST_FEATURE(signal);
-    }
-    logger->result(res);
-}
-#undef TEST_FEATURE
+    commands::list(cc.get_option<_box_root>());
+}
 
 template<>
 void command_callback(const decltype(cotton_command)& cc, const decltype(create_command)& crc) {
-    if (!box_creators->count(crc.get_positional<_box_type>()[0])) {
-        logger->error(2, "The given box type does not exist!");
-        return;
-    }
-    auto box_creator = (*box_creators)[crc.get_positional<_box_type>()[0]];
-    std::unique_ptr<Sandbox> s(box_creator(cc.get_option<_box_root>()));
-    s->set_error_handler(logger->get_error_function());
-    s->set_warning_handler(logger->get_warning_function());
-    if (!s->is_available()) {
-        logger->error(2, "The given box type is not available!");
-        return;
-    }
-    s->create_box();
-    save_box(cc.get_option<_box_root>(), s);
-    logger->result(s->get_id());
+    commands::create(cc.get_option<_box_root>(), crc.get_positional<_box_type>()[0]);
 }
 
 template<>
@@ -211,8 +221,7 @@ void command_callback(const decltype(cotton_command)& cc, const decltype(check_c
         logger->error(2, "You need to specify a box id!");
         return;
     }
-    auto s = load_box(cc.get_option<_box_root>(), cc.get_option<_box_id>());
-    logger->result(s.get() == nullptr ? false : s->check());
+    commands::check(cc.get_option<_box_root>(), cc.get_option<_box_id>());
 }
 
 template<>
@@ -221,8 +230,7 @@ void command_callback(const decltype(cotton_command)& cc, const decltype(get_roo
         logger->error(2, "You need to specify a box id!");
         return;
     }
-    auto s = load_box(cc.get_option<_box_root>(), cc.get_option<_box_id>());
-    logger->result(s.get() == nullptr ? "" : s->get_root());
+    commands::get_root(cc.get_option<_box_root>(), cc.get_option<_box_id>());
 }
 
 template<>
@@ -231,13 +239,10 @@ void command_callback(const decltype(cotton_command)& cc, const decltype(memory_
         logger->error(2, "You need to specify a box id!");
         return;
     }
-    auto s = load_box(cc.get_option<_box_root>(), cc.get_option<_box_id>());
     if (lc.count_positional<_value>() > 0) {
-        auto val = lc.get_positional<_value>()[0];
-        logger->result(s.get() == nullptr ? false : s->set_memory_limit(val));
-        save_box(cc.get_option<_box_root>(), s);
+        commands::memory_limit(cc.get_option<_box_root>(), cc.get_option<_box_id>(), lc.get_positional<_value>()[0]);
     } else {
-        logger->result(s.get() == nullptr ? 0 : s->get_memory_limit());
+        commands::memory_limit(cc.get_option<_box_root>(), cc.get_option<_box_id>());
     }
 }
 
@@ -247,13 +252,10 @@ void command_callback(const decltype(cotton_command)& cc, const decltype(cpu_lim
         logger->error(2, "You need to specify a box id!");
         return;
     }
-    auto s = load_box(cc.get_option<_box_root>(), cc.get_option<_box_id>());
     if (lc.count_positional<_value>() > 0) {
-        auto val = lc.get_positional<_value>()[0];
-        logger->result(s.get() == nullptr ? false : s->set_time_limit(val));
-        save_box(cc.get_option<_box_root>(), s);
+        commands::cpu_limit(cc.get_option<_box_root>(), cc.get_option<_box_id>(), lc.get_positional<_value>()[0]);
     } else {
-        logger->result(s.get() == nullptr ? 0 : s->get_time_limit());
+        commands::cpu_limit(cc.get_option<_box_root>(), cc.get_option<_box_id>());
     }
 }
 
@@ -263,13 +265,10 @@ void command_callback(const decltype(cotton_command)& cc, const decltype(wall_li
         logger->error(2, "You need to specify a box id!");
         return;
     }
-    auto s = load_box(cc.get_option<_box_root>(), cc.get_option<_box_id>());
     if (lc.count_positional<_value>() > 0) {
-        auto val = lc.get_positional<_value>()[0];
-        logger->result(s.get() == nullptr ? false : s->set_wall_time_limit(val));
-        save_box(cc.get_option<_box_root>(), s);
+        commands::wall_limit(cc.get_option<_box_root>(), cc.get_option<_box_id>(), lc.get_positional<_value>()[0]);
     } else {
-        logger->result(s.get() == nullptr ? 0 : s->get_wall_time_limit());
+        commands::wall_limit(cc.get_option<_box_root>(), cc.get_option<_box_id>());
     }
 }
 
@@ -279,13 +278,10 @@ void command_callback(const decltype(cotton_command)& cc, const decltype(process
         logger->error(2, "You need to specify a box id!");
         return;
     }
-    auto s = load_box(cc.get_option<_box_root>(), cc.get_option<_box_id>());
     if (lc.count_positional<_value>() > 0) {
-        auto val = lc.get_positional<_value>()[0];
-        logger->result(s.get() == nullptr ? false : s->set_process_limit(val));
-        save_box(cc.get_option<_box_root>(), s);
+        commands::process_limit(cc.get_option<_box_root>(), cc.get_option<_box_id>(), lc.get_positional<_value>()[0]);
     } else {
-        logger->result(s.get() == nullptr ? 0 : s->get_process_limit());
+        commands::process_limit(cc.get_option<_box_root>(), cc.get_option<_box_id>());
     }
 }
 
@@ -295,57 +291,114 @@ void command_callback(const decltype(cotton_command)& cc, const decltype(disk_li
         logger->error(2, "You need to specify a box id!");
         return;
     }
-    auto s = load_box(cc.get_option<_box_root>(), cc.get_option<_box_id>());
     if (lc.count_positional<_value>() > 0) {
-        auto val = lc.get_positional<_value>()[0];
-        logger->result(s.get() == nullptr ? false : s->set_disk_limit(val));
-        save_box(cc.get_option<_box_root>(), s);
+        commands::disk_limit(cc.get_option<_box_root>(), cc.get_option<_box_id>(), lc.get_positional<_value>()[0]);
     } else {
-        logger->result(s.get() == nullptr ? 0 : s->get_disk_limit());
+        commands::disk_limit(cc.get_option<_box_root>(), cc.get_option<_box_id>());
     }
 }
 
 template<>
-void command_callback(const decltype(cotton_command)& cc, const decltype(redirect_command)& rc) {
+void command_callback(const decltype(cotton_command)& cc, const decltype(perf_counters_command)& pc) {
     if (!cc.has_option<_box_id>()) {
         logger->error(2, "You need to specify a box id!");
         return;
     }
-    auto s = load_box(cc.get_option<_box_root>(), cc.get_option<_box_id>());
-    std::string stream = rc.get_positional<_stream>()[0];
-    if (rc.count_positional<_value>() > 0) {
-        if (s.get() == nullptr) {
+    if (pc.count_positional<_value>() > 0) {
+        commands::perf_counters(cc.get_option<_box_root>(), cc.get_option<_box_id>(), pc.get_positional<_value>()[0] != 0);
+    } else {
+        commands::perf_counters(cc.get_option<_box_root>(), cc.get_option<_box_id>());
+    }
+}
+
+template<>
+void command_callback(const decltype(cotton_command)& cc, const decltype(instruction_limit_command)& lc) {
+    if (!cc.has_option<_box_id>()) {
+        logger->error(2, "You need to specify a box id!");
+        return;
+    }
+    if (lc.count_positional<_value>() > 0) {
+        uint64_t value;
+        try {
+            value = std::stoull(lc.get_positional<_value>()[0]);
+        } catch (std::exception&) {
+            logger->error(2, "Invalid instruction limit");
             logger->result(false);
             return;
         }
-        std::string val = rc.get_positional<_value>()[0];
-        if (val == "-") val = "";
-        if (stream == "stdin") {
-            logger->result(s->redirect_stdin(val));
-        } else if (stream == "stdout") {
-            logger->result(s->redirect_stdout(val));
-        } else if (stream == "stderr") {
-            logger->result(s->redirect_stderr(val));
-        } else {
-            logger->error(2, "Invalid redirect type given");
-            logger->result(false);
-        }
-        save_box(cc.get_option<_box_root>(), s);
+        commands::instruction_limit(cc.get_option<_box_root>(), cc.get_option<_box_id>(), value);
     } else {
-        if (s.get() == nullptr) {
-            logger->result("");
-            return;
-        }
-        if (stream == "stdin") {
-            logger->result(s->get_stdin());
-        } else if (stream == "stdout") {
-            logger->result(s->get_stdout());
-        } else if (stream == "stderr") {
-            logger->result(s->get_stderr());
-        } else {
-            logger->error(2, "Invalid redirect type given");
-            logger->result(false);
-        }
+        commands::instruction_limit(cc.get_option<_box_root>(), cc.get_option<_box_id>());
+    }
+}
+
+template<>
+void command_callback(const decltype(cotton_command)& cc, const decltype(output_limit_command)& lc) {
+    if (!cc.has_option<_box_id>()) {
+        logger->error(2, "You need to specify a box id!");
+        return;
+    }
+    if (lc.count_positional<_value>() > 0) {
+        commands::output_limit(cc.get_option<_box_root>(), cc.get_option<_box_id>(), lc.get_positional<_value>()[0]);
+    } else {
+        commands::output_limit(cc.get_option<_box_root>(), cc.get_option<_box_id>());
+    }
+}
+
+template<>
+void command_callback(const decltype(cotton_command)& cc, const decltype(output_check_command)& oc) {
+    if (!cc.has_option<_box_id>()) {
+        logger->error(2, "You need to specify a box id!");
+        return;
+    }
+    if (oc.count_positional<_value>() > 0) {
+        std::string mode = oc.count_positional<_mode>() > 0 ? oc.get_positional<_mode>()[0] : "exact";
+        double tolerance = oc.count_positional<_tolerance>() > 0 ? oc.get_positional<_tolerance>()[0] : 0;
+        commands::output_check(cc.get_option<_box_root>(), cc.get_option<_box_id>(), oc.get_positional<_value>()[0],
+            mode, tolerance);
+    } else {
+        commands::output_check(cc.get_option<_box_root>(), cc.get_option<_box_id>());
+    }
+}
+
+template<>
+void command_callback(const decltype(cotton_command)& cc, const decltype(syscall_profile_command)& sc) {
+    if (!cc.has_option<_box_id>()) {
+        logger->error(2, "You need to specify a box id!");
+        return;
+    }
+    if (sc.count_positional<_value>() > 0) {
+        commands::syscall_profile(cc.get_option<_box_root>(), cc.get_option<_box_id>(), sc.get_positional<_value>()[0]);
+    } else {
+        commands::syscall_profile(cc.get_option<_box_root>(), cc.get_option<_box_id>());
+    }
+}
+
+template<>
+void command_callback(const decltype(cotton_command)& cc, const decltype(redirect_command)& rc) {
+    if (!cc.has_option<_box_id>()) {
+        logger->error(2, "You need to specify a box id!");
+        return;
+    }
+    std::string stream = rc.get_positional<_stream>()[0];
+    if (rc.count_positional<_value>() > 0) {
+        commands::redirect(cc.get_option<_box_root>(), cc.get_option<_box_id>(), stream, rc.get_positional<_value>()[0]);
+    } else {
+        commands::redirect(cc.get_option<_box_root>(), cc.get_option<_box_id>(), stream);
+    }
+}
+
+template<>
+void command_callback(const decltype(cotton_command)& cc, const decltype(root_fs_command)& rc) {
+    if (!cc.has_option<_box_id>()) {
+        logger->error(2, "You need to specify a box id!");
+        return;
+    }
+    if (rc.count_positional<_value>() > 0) {
+        std::string lower_path = rc.count_positional<_external_path>() > 0 ? rc.get_positional<_external_path>()[0] : "";
+        commands::root_fs(cc.get_option<_box_root>(), cc.get_option<_box_id>(), rc.get_positional<_value>()[0], lower_path);
+    } else {
+        commands::root_fs(cc.get_option<_box_root>(), cc.get_option<_box_id>());
     }
 }
 
@@ -355,14 +408,12 @@ void command_callback(const decltype(cotton_command)& cc, const decltype(mount_c
         logger->error(2, "You need to specify a box id!");
         return;
     }
-    auto s = load_box(cc.get_option<_box_root>(), cc.get_option<_box_id>());
     std::string inner_path = mc.get_positional<_internal_path>()[0];
     if (mc.count_positional<_external_path>() > 0) {
         std::string val = mc.get_positional<_external_path>()[0];
-        logger->result(s.get() == nullptr ? false : s->mount(inner_path, val, mc.has_option<_rw>()));
-        save_box(cc.get_option<_box_root>(), s);
+        commands::mount(cc.get_option<_box_root>(), cc.get_option<_box_id>(), inner_path, val, mc.has_option<_rw>());
     } else {
-        logger->result(s.get() == nullptr ? "" : s->mount(inner_path));
+        commands::mount(cc.get_option<_box_root>(), cc.get_option<_box_id>(), inner_path);
     }
 }
 
@@ -372,10 +423,17 @@ void command_callback(const decltype(cotton_command)& cc, const decltype(umount_
         logger->error(2, "You need to specify a box id!");
         return;
     }
-    auto s = load_box(cc.get_option<_box_root>(), cc.get_option<_box_id>());
-    std::string inner_path = uc.get_positional<_internal_path>()[0];
-    logger->result(s.get() == nullptr ? false : s->umount(inner_path));
-    save_box(cc.get_option<_box_root>(), s);
+    commands::umount(cc.get_option<_box_root>(), cc.get_option<_box_id>(), uc.get_positional<_internal_path>()[0]);
+}
+
+template<>
+void command_callback(const decltype(cotton_command)& cc, const decltype(import_command)& ic) {
+    if (!cc.has_option<_box_id>()) {
+        logger->error(2, "You need to specify a box id!");
+        return;
+    }
+    commands::import(cc.get_option<_box_root>(), cc.get_option<_box_id>(), ic.get_positional<_internal_path>()[0],
+        ic.get_positional<_external_path>()[0], ic.has_option<_rw>());
 }
 
 
@@ -385,13 +443,64 @@ void command_callback(const decltype(cotton_command)& cc, const decltype(run_com
         logger->error(2, "You need to specify a box id!");
         return;
     }
-    auto s = load_box(cc.get_option<_box_root>(), cc.get_option<_box_id>());
     std::string exec = rc.get_positional<_exec>()[0];
     auto args = rc.get_positional<_arg>();
     std::vector<std::string> s_args;
     for (const auto str: args) s_args.emplace_back(str);
-    logger->result(s.get() == nullptr ? false : s->run(exec, s_args));
-    save_box(cc.get_option<_box_root>(), s);
+    commands::run(cc.get_option<_box_root>(), cc.get_option<_box_id>(), exec, s_args);
+}
+
+template<>
+void command_callback(const decltype(cotton_command)& cc, const decltype(run_many_command)& rmc) {
+    if (!cc.has_option<_box_id>()) {
+        logger->error(2, "You need to specify a box id!");
+        return;
+    }
+    if (!rmc.has_option<_cases>()) {
+        logger->error(2, "You need to specify the cases!");
+        return;
+    }
+    std::ifstream fin(rmc.get_option<_cases>());
+    if (!fin) {
+        logger->error(2, std::string("Cannot open ") + rmc.get_option<_cases>());
+        return;
+    }
+    std::vector<std::pair<std::string, std::string>> cases;
+    std::string line;
+    // Paths may contain spaces, so the two of them are split on a tab.
+    for (size_t line_number = 1; std::getline(fin, line); line_number++) {
+        if (!line.empty() && line.back() == '\r') line.pop_back();
+        if (line.empty()) continue;
+        size_t tab = line.find('\t');
+        if (tab == 0 || tab == std::string::npos || tab + 1 == line.size() ||
+            line.find('\t', tab + 1) != std::string::npos) {
+            logger->error(2, "Line " + std::to_string(line_number) + " of the cases needs two fields separated by a tab");
+            return;
+        }
+        std::string in = line.substr(0, tab), out = line.substr(tab + 1);
+        cases.emplace_back(in == "-" ? "" : in, out == "-" ? "" : out);
+    }
+    std::string exec = rmc.get_positional<_exec>()[0];
+    std::vector<std::string> s_args;
+    for (const auto str: rmc.get_positional<_arg>()) s_args.emplace_back(str);
+    commands::run_many(cc.get_option<_box_root>(), cc.get_option<_box_id>(), exec, s_args, cases);
+}
+
+template<>
+void command_callback(const decltype(cotton_command)& cc, const decltype(run_interactive_command)& ric) {
+    if (!cc.has_option<_box_id>() || !ric.has_option<_manager_box>()) {
+        logger->error(2, "You need to specify the box ids of the program and of the manager!");
+        return;
+    }
+    if (!ric.has_option<_manager>()) {
+        logger->error(2, "You need to specify the manager!");
+        return;
+    }
+    std::string exec = ric.get_positional<_exec>()[0];
+    std::vector<std::string> s_args;
+    for (const auto str: ric.get_positional<_arg>()) s_args.emplace_back(str);
+    commands::run_interactive(cc.get_option<_box_root>(), cc.get_option<_box_id>(), exec, s_args,
+        ric.get_option<_manager_box>(), ric.get_option<_manager>(), {});
 }
 
 template<>
@@ -400,8 +509,7 @@ void command_callback(const decltype(cotton_command)& cc, const decltype(memory_
         logger->error(2, "You need to specify a box id!");
         return;
     }
-    auto s = load_box(cc.get_option<_box_root>(), cc.get_option<_box_id>());
-    logger->result(s.get() == nullptr ? space_limit_t(0) : s->get_memory_usage());
+    commands::memory_usage(cc.get_option<_box_root>(), cc.get_option<_box_id>());
 }
 
 template<>
@@ -410,8 +518,7 @@ void command_callback(const decltype(cotton_command)& cc, const decltype(running
         logger->error(2, "You need to specify a box id!");
         return;
     }
-    auto s = load_box(cc.get_option<_box_root>(), cc.get_option<_box_id>());
-    logger->result(s.get() == nullptr ? time_limit_t(0) : s->get_running_time());
+    commands::running_time(cc.get_option<_box_root>(), cc.get_option<_box_id>());
 }
 
 template<>
@@ -420,8 +527,7 @@ void command_callback(const decltype(cotton_command)& cc, const decltype(wall_ti
         logger->error(2, "You need to specify a box id!");
         return;
     }
-    auto s = load_box(cc.get_option<_box_root>(), cc.get_option<_box_id>());
-    logger->result(s.get() == nullptr ? time_limit_t(0) : s->get_wall_time());
+    commands::wall_time(cc.get_option<_box_root>(), cc.get_option<_box_id>());
 }
 
 template<>
@@ -430,8 +536,7 @@ void command_callback(const decltype(cotton_command)& cc, const decltype(status_
         logger->error(2, "You need to specify a box id!");
         return;
     }
-    auto s = load_box(cc.get_option<_box_root>(), cc.get_option<_box_id>());
-    logger->result(s.get() == nullptr ? "" : s->get_status());
+    commands::status(cc.get_option<_box_root>(), cc.get_option<_box_id>());
 }
 
 template<>
@@ -440,8 +545,7 @@ void command_callback(const decltype(cotton_command)& cc, const decltype(return_
         logger->error(2, "You need to specify a box id!");
         return;
     }
-    auto s = load_box(cc.get_option<_box_root>(), cc.get_option<_box_id>());
-    logger->result(s.get() == nullptr ? 0 : s->get_return_code());
+    commands::return_code(cc.get_option<_box_root>(), cc.get_option<_box_id>());
 }
 
 template<>
@@ -450,8 +554,42 @@ void command_callback(const decltype(cotton_command)& cc, const decltype(signal_
         logger->error(2, "You need to specify a box id!");
         return;
     }
-    auto s = load_box(cc.get_option<_box_root>(), cc.get_option<_box_id>());
-    logger->result(s.get() == nullptr ? 0 : s->get_signal());
+    commands::signal(cc.get_option<_box_root>(), cc.get_option<_box_id>());
+}
+
+template<>
+void command_callback(const decltype(cotton_command)& cc, const decltype(run_result_command)& rrc) {
+    if (!cc.has_option<_box_id>()) {
+        logger->error(2, "You need to specify a box id!");
+        return;
+    }
+    commands::run_result(cc.get_option<_box_root>(), cc.get_option<_box_id>());
+}
+
+template<>
+void command_callback(const decltype(cotton_command)& cc, const decltype(output_command)& oc) {
+    if (!cc.has_option<_box_id>()) {
+        logger->error(2, "You need to specify a box id!");
+        return;
+    }
+    commands::output(cc.get_option<_box_root>(), cc.get_option<_box_id>(), oc.get_positional<_stream>()[0]);
+}
+
+template<>
+void command_callback(const decltype(cotton_command)& cc, const decltype(export_command)& ec) {
+    if (!cc.has_option<_box_id>()) {
+        logger->error(2, "You need to specify a box id!");
+        return;
+    }
+    if (!ec.has_option<_to>()) {
+        logger->error(2, "You need to specify where to write the files!");
+        return;
+    }
+    std::vector<std::string> patterns;
+    for (const auto str: ec.get_positional<_files>()) patterns.emplace_back(str);
+    space_limit_t max_size = ec.has_option<_max_size>() ? ec.get_option<_max_size>() : space_limit_t(0);
+    commands::export_files(cc.get_option<_box_root>(), cc.get_option<_box_id>(), patterns, ec.get_option<_to>(),
+        max_size);
 }
 
 template<>
@@ -460,9 +598,7 @@ void command_callback(const decltype(cotton_command)& cc, const decltype(clear_c
         logger->error(2, "You need to specify a box id!");
         return;
     }
-    auto s = load_box(cc.get_option<_box_root>(), cc.get_option<_box_id>());
-    logger->result(s.get() == nullptr ? false : s->clear());
-    save_box(cc.get_option<_box_root>(), s);
+    commands::clear(cc.get_option<_box_root>(), cc.get_option<_box_id>());
 }
 
 
@@ -472,8 +608,38 @@ void command_callback(const decltype(cotton_command)& cc, const decltype(destroy
         logger->error(2, "You need to specify a box id!");
         return;
     }
-    auto s = load_box(cc.get_option<_box_root>(), cc.get_option<_box_id>());
-    logger->result(s.get() == nullptr ? false : s->delete_box());
+    commands::destroy(cc.get_option<_box_root>(), cc.get_option<_box_id>());
+}
+
+template<>
+void command_callback(const decltype(cotton_command)& cc, const decltype(serve_command)& sc) {
+    std::string box_root = cc.get_option<_box_root>();
+    std::string socket_path = box_root + "/cotton.sock";
+    if (sc.count_positional<_socket>() > 0) socket_path = sc.get_positional<_socket>()[0];
+    logger->result(serve(box_root, socket_path));
+}
+
+template<>
+void command_callback(const decltype(cotton_command)& cc, const decltype(batch_command)& bc) {
+    std::string file = bc.count_positional<_file>() > 0 ? bc.get_positional<_file>()[0] : "-";
+    std::ifstream fin;
+    if (file != "-") {
+        fin.open(file);
+        if (!fin) {
+            logger->error(2, "Cannot open " + file);
+            return;
+        }
+    }
+    std::istream& in = file == "-" ? std::cin : fin;
+    if (bc.has_option<_parallel>()) {
+#ifdef COTTON_LINUX
+        logger->result(run_parallel_batch(cc.get_option<_box_root>(), in));
+#else
+        logger->error(2, "Parallel batches are not supported on this system");
+#endif
+        return;
+    }
+    logger->result(run_batch(cc.get_option<_box_root>(), in));
 }
 
 } // namespace program_options
@@ -504,5 +670,8 @@ int main(int argc, const char** argv) {
     } catch (std::exception& e) {
         logger->error(255, std::string("Unandled exception! ") + e.what());
     }
+    if (program_options::report_timings) logger->timings(trace::durations());
+    if (!program_options::trace_file.empty() && !trace::write_chrome_trace(program_options::trace_file))
+        logger->warning(4, "Cannot write the trace to " + program_options::trace_file);
     logger->write();
 }
@@ -0,0 +1,160 @@
+#include "util.hpp"
+#ifdef COTTON_UNIX
+#include "output_checker.hpp"
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdlib>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+// Output tokens are cut when they get longer than this and than the expected
+// token, so that a program cannot fill the memory without spaces.
+const size_t max_token_size = 4096;
+
+bool is_space(char c) {
+    return isspace((unsigned char)c);
+}
+
+std::string quote(const char* s, size_t len) {
+    if (len > 32) return "\"" + std::string(s, 29) + "...\"";
+    return "\"" + std::string(s, len) + "\"";
+}
+
+bool parse_number(const std::string& s, double& value) {
+    char* end;
+    value = strtod(s.c_str(), &end);
+    return !s.empty() && *end == 0 && std::isfinite(value);
+}
+}
+
+bool OutputChecker::parse_mode(const std::string& name, Mode& mode) {
+    if (name == "exact") mode = Mode::exact;
+    else if (name == "tokens") mode = Mode::tokens;
+    else if (name == "floats") mode = Mode::floats;
+    else return false;
+    return true;
+}
+
+OutputChecker::~OutputChecker() {
+    if (expected != nullptr) munmap((void*)expected, size);
+}
+
+bool OutputChecker::open(const std::string& path, Mode mode, double tolerance) {
+    this->mode = mode;
+    this->tolerance = tolerance;
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd == -1) return false;
+    struct stat info;
+    if (fstat(fd, &info) == -1) {
+        close(fd);
+        return false;
+    }
+    size = info.st_size;
+    if (size > 0) {
+        void* data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED) {
+            int err = errno;
+            close(fd);
+            size = 0;
+            errno = err;
+            return false;
+        }
+        expected = (const char*)data;
+#ifdef MADV_SEQUENTIAL
+        madvise(data, size, MADV_SEQUENTIAL);
+#endif
+    }
+    close(fd);
+    return true;
+}
+
+size_t OutputChecker::next_token(size_t& begin) const {
+    begin = pos;
+    while (begin < size && is_space(expected[begin])) begin++;
+    size_t end = begin;
+    while (end < size && !is_space(expected[end])) end++;
+    return end - begin;
+}
+
+bool OutputChecker::same_token(const char* exp, size_t len) const {
+    if (token.size() == len && memcmp(token.data(), exp, len) == 0) return true;
+    if (mode != Mode::floats) return false;
+    double out_value, exp_value;
+    if (!parse_number(token, out_value) || !parse_number(std::string(exp, len), exp_value)) return false;
+    double diff = std::abs(out_value - exp_value);
+    return diff <= tolerance || diff <= tolerance * std::abs(exp_value);
+}
+
+bool OutputChecker::check_token() {
+    size_t begin;
+    size_t len = next_token(begin);
+    token_count++;
+    if (len == 0) {
+        mismatch_ = "Output longer than expected, at token " + std::to_string(token_count);
+        return false;
+    }
+    if (!same_token(expected + begin, len)) {
+        mismatch_ = "Read " + quote(token.data(), token.size()) + " instead of " + quote(expected + begin, len) +
+            " at token " + std::to_string(token_count);
+        return false;
+    }
+    pos = begin + len;
+    token.clear();
+    token_limit = 0;
+    return true;
+}
+
+bool OutputChecker::feed(const char* data, size_t len) {
+    if (!mismatch_.empty()) return false;
+    if (mode == Mode::exact) {
+        size_t common = std::min(len, size - pos);
+        const char* exp = expected + pos;
+        for (size_t i=0; i<common; i++) {
+            if (data[i] == exp[i]) continue;
+            mismatch_ = "Output differs at byte " + std::to_string(pos + i);
+            return false;
+        }
+        pos += common;
+        if (common < len) {
+            mismatch_ = "Output longer than expected, at byte " + std::to_string(pos);
+            return false;
+        }
+        return true;
+    }
+    for (size_t i=0; i<len; i++) {
+        if (!is_space(data[i])) {
+            token += data[i];
+            if (token.size() < max_token_size) continue;
+            // The expected token is looked up once, not at every byte.
+            if (token_limit == 0) {
+                size_t begin;
+                token_limit = std::max(max_token_size, next_token(begin));
+            }
+            if (token.size() <= token_limit) continue;
+            mismatch_ = "Token " + std::to_string(token_count + 1) + " is too long";
+            return false;
+        }
+        if (!token.empty() && !check_token()) return false;
+    }
+    return true;
+}
+
+bool OutputChecker::finish() {
+    if (!mismatch_.empty()) return false;
+    if (mode == Mode::exact) {
+        if (pos == size) return true;
+        mismatch_ = "Output shorter than expected, at byte " + std::to_string(pos);
+        return false;
+    }
+    if (!token.empty() && !check_token()) return false;
+    size_t begin;
+    if (next_token(begin) == 0) return true;
+    mismatch_ = "Output shorter than expected, at token " + std::to_string(token_count + 1);
+    return false;
+}
+
+#endif
@@ -0,0 +1,116 @@
+#include "util.hpp"
+#ifdef COTTON_LINUX
+#include "perf_counters.hpp"
+#include <fstream>
+#include <fcntl.h>
+#include <linux/perf_event.h>
+#include <pthread.h>
+#include <sys/signalfd.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace {
+// Sent to the thread that runs the box when the instruction limit is reached.
+const int overflow_signal = SIGIO;
+
+int open_counter(uint32_t type, uint64_t config, uint64_t sample_period) {
+    struct perf_event_attr attr = {};
+    attr.size = sizeof attr;
+    attr.type = type;
+    attr.config = config;
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    attr.disabled = 1;
+    attr.enable_on_exec = 1;
+    attr.inherit = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.sample_period = sample_period;
+    attr.wakeup_events = sample_period ? 1 : 0;
+    return syscall(SYS_perf_event_open, &attr, 0, -1, -1, PERF_FLAG_FD_CLOEXEC);
+}
+
+std::string check_availability() {
+    int fd = open_counter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS, 0);
+    if (fd != -1) {
+        ::close(fd);
+        return "";
+    }
+    std::string reason = serror("perf_event_open", errno);
+    if (errno == ENOENT || errno == EOPNOTSUPP) {
+        reason += " (no hardware counters, e.g. in a virtual machine)";
+    } else if (errno == EACCES || errno == EPERM) {
+        std::ifstream paranoid("/proc/sys/kernel/perf_event_paranoid");
+        int level;
+        if (paranoid >> level) reason += " (kernel.perf_event_paranoid is " + std::to_string(level) + ")";
+    }
+    return reason;
+}
+}
+
+const std::string& PerfCounters::unavailable_reason() {
+    static const std::string reason = check_availability();
+    return reason;
+}
+
+bool PerfCounters::open(uint64_t instruction_limit, int fds[counter_count]) {
+    fds[instructions] = open_counter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS, instruction_limit);
+    if (fds[instructions] == -1) return false;
+    fds[cycles] = open_counter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES, 0);
+    fds[task_clock] = open_counter(PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK, 0);
+    return true;
+}
+
+bool PerfCounters::attach(const int fds[counter_count], bool watch_overflow) {
+    close();
+    for (int i=0; i<counter_count; i++) this->fds[i] = fds[i];
+    if (!watch_overflow) return true;
+    // Block the signal in this thread only, and get it from a signalfd.
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, overflow_signal);
+    if (pthread_sigmask(SIG_BLOCK, &mask, &saved_mask) != 0) return false;
+    signal_fd = signalfd(-1, &mask, SFD_CLOEXEC | SFD_NONBLOCK);
+    if (signal_fd == -1) {
+        pthread_sigmask(SIG_SETMASK, &saved_mask, nullptr);
+        return false;
+    }
+    int fd = fds[instructions];
+    struct f_owner_ex owner = {F_OWNER_TID, (pid_t)syscall(SYS_gettid)};
+    if (fcntl(fd, F_SETOWN_EX, &owner) == -1 || fcntl(fd, F_SETSIG, overflow_signal) == -1 ||
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_ASYNC) == -1) {
+        int err = errno;
+        close();
+        errno = err;
+        return false;
+    }
+    return true;
+}
+
+uint64_t PerfCounters::get(counter_t counter) const {
+    if (fds[counter] == -1) return 0;
+    struct {uint64_t value, time_enabled, time_running;} data;
+    if (read(fds[counter], &data, sizeof data) != sizeof data || data.time_running == 0) return 0;
+    // The counter was multiplexed with others: scale it to the whole run.
+    if (data.time_running < data.time_enabled)
+        return (unsigned __int128)data.value * data.time_enabled / data.time_running;
+    return data.value;
+}
+
+void PerfCounters::close() {
+    for (auto& fd: fds) {
+        if (fd != -1) ::close(fd);
+        fd = -1;
+    }
+    if (signal_fd == -1) return;
+    // Discard the overflows that were not read before unblocking the signal.
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, overflow_signal);
+    struct timespec no_wait = {0, 0};
+    while (sigtimedwait(&mask, nullptr, &no_wait) > 0);
+    ::close(signal_fd);
+    signal_fd = -1;
+    pthread_sigmask(SIG_SETMASK, &saved_mask, nullptr);
+}
+
+#endif
@@ -0,0 +1,329 @@
+#include "util.hpp"
+#ifdef COTTON_UNIX
+#include "server.hpp"
+#include "DummyUnixSandbox.hpp"
+#include "commands.hpp"
+#include "cpu_pool.hpp"
+#include "logger.hpp"
+#include "trace.hpp"
+#include "zygote.hpp"
+#include <algorithm>
+#include <iostream>
+#include <sstream>
+#include <arpa/inet.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+namespace {
+const uint32_t max_request_size = 16*1024*1024;
+const time_t request_timeout = 10; // Seconds to move the rest of a message
+
+// The file descriptors sent with the message are appended to fds.
+bool read_message(int fd, std::string& msg, std::vector<int>& fds) {
+    uint32_t len;
+    int received[8];
+    size_t count = 8;
+    bool ok = receive_fds(fd, &len, sizeof len, received, count);
+    fds.insert(fds.end(), received, received + count);
+    if (!ok) return false;
+    len = ntohl(len);
+    if (len > max_request_size) return false;
+    msg.resize(len);
+    return read_all(fd, &msg[0], len);
+}
+
+bool write_message(int fd, const std::string& msg) {
+    uint32_t len = htonl(msg.size());
+    return send_all(fd, &len, sizeof len) && send_all(fd, msg.data(), msg.size());
+}
+
+// Boxes live longer than a single command: keep them, and their zygotes, in
+// memory.
+void set_persistent(bool enabled) {
+    set_box_cache(enabled);
+#ifdef COTTON_LINUX
+    Zygote::set_enabled(enabled);
+#endif
+}
+
+// The streams of this process carry the requests and the replies, so the boxes
+// get /dev/null instead of them unless they are redirected.
+void hide_streams(bool hidden) {
+    DummyUnixSandbox::set_inherit_streams(!hidden);
+}
+
+}
+
+void handle_request(const std::string& box_root, const std::string& request, std::ostream& out) {
+    CottonJSONLogger request_logger(out);
+    CottonLogger* old_logger = logger;
+    logger = &request_logger;
+    try {
+        json_value cmd = json_value::parse(request);
+        bool report_timings = cmd.is_object() && cmd.has("timings") && cmd["timings"].as_bool();
+        std::string trace_file = cmd.is_object() && cmd.has("trace") ? cmd["trace"].as_string() : "";
+        if (report_timings || !trace_file.empty()) trace::start();
+        commands::execute(box_root, cmd);
+        if (report_timings) logger->timings(trace::durations());
+        if (!trace_file.empty() && !trace::write_chrome_trace(trace_file))
+            logger->warning(4, "Cannot write the trace to " + trace_file);
+    } catch (std::exception& e) {
+        logger->error(2, std::string("Invalid request: ") + e.what());
+    }
+    trace::stop();
+    logger = old_logger;
+    request_logger.write();
+}
+
+bool serve(const std::string& box_root, const std::string& socket_path) {
+    struct sockaddr_un addr = {};
+    addr.sun_family = AF_UNIX;
+    if (socket_path.size() >= sizeof addr.sun_path) {
+        logger->error(2, "The socket path is too long");
+        return false;
+    }
+    strcpy(addr.sun_path, socket_path.c_str());
+    int sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (sock == -1) {
+        logger->error(4, serror("Error creating the socket"));
+        return false;
+    }
+    unlink(socket_path.c_str());
+    if (bind(sock, (struct sockaddr*)&addr, sizeof addr) == -1 || listen(sock, 16) == -1) {
+        logger->error(4, serror("Error listening on " + socket_path));
+        close(sock);
+        return false;
+    }
+    set_persistent(true);
+    hide_streams(true);
+    // Every connection is served as soon as it sends a request, so that a
+    // client that keeps its connection open does not hold up the others. The
+    // descriptors passed by a client stay open as long as its connection, so
+    // that the boxes redirected to them can be run by the following requests.
+    struct Connection {
+        int fd;
+        std::vector<int> passed_fds;
+    };
+    std::vector<Connection> conns;
+    bool ok = true;
+    while (ok) {
+        std::vector<struct pollfd> fds = {{sock, POLLIN, 0}};
+        for (const auto& conn: conns) fds.push_back({conn.fd, POLLIN, 0});
+        if (poll(fds.data(), fds.size(), -1) == -1) {
+            if (errno == EINTR) continue;
+            logger->error(4, serror("Error waiting for requests"));
+            break;
+        }
+        // Handled in order of connection, one request per connection at a time.
+        for (size_t i=1; i<fds.size(); i++) {
+            if (!fds[i].revents) continue;
+            Connection& conn = conns[i-1];
+            std::string request;
+            size_t first_fd = conn.passed_fds.size();
+            bool open = read_message(conn.fd, request, conn.passed_fds);
+            if (open) {
+                std::ostringstream reply;
+                set_passed_fds(std::vector<int>(conn.passed_fds.begin() + first_fd, conn.passed_fds.end()));
+                handle_request(box_root, request, reply);
+                set_passed_fds({});
+                open = write_message(conn.fd, reply.str());
+            }
+            if (open) continue;
+            for (int fd: conn.passed_fds) close(fd);
+            close(conn.fd);
+            conn.fd = -1;
+        }
+        conns.erase(std::remove_if(conns.begin(), conns.end(), [](const Connection& conn) {
+            return conn.fd == -1;
+        }), conns.end());
+        if (!(fds[0].revents & POLLIN)) continue;
+        int conn = accept4(sock, nullptr, nullptr, SOCK_CLOEXEC);
+        if (conn == -1) {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            logger->error(4, serror("Error accepting connections"));
+            ok = false;
+            continue;
+        }
+        // A client that stops in the middle of a request, or does not read
+        // the reply, is dropped.
+        struct timeval timeout = {request_timeout, 0};
+        setsockopt(conn, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof timeout);
+        setsockopt(conn, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof timeout);
+        conns.push_back({conn, {}});
+    }
+    for (const auto& conn: conns) {
+        for (int fd: conn.passed_fds) close(fd);
+        close(conn.fd);
+    }
+    set_persistent(false);
+    hide_streams(false);
+    close(sock);
+    return false;
+}
+
+size_t run_batch(const std::string& box_root, std::istream& in) {
+    size_t executed = 0;
+    std::string line;
+    set_persistent(true);
+    hide_streams(true);
+    while (std::getline(in, line)) {
+        if (line.find_first_not_of(" \t\r") == std::string::npos) continue;
+        handle_request(box_root, line, std::cout);
+        executed++;
+    }
+    set_persistent(false);
+    hide_streams(false);
+    return executed;
+}
+
+#ifdef COTTON_LINUX
+namespace {
+struct ParallelJob {
+    pid_t pid;
+    int sock;
+    int cpu;
+    std::string box;
+    size_t index;
+    std::string reply;
+};
+
+// Finds the box a command works on, if any, whether it runs a program, and
+// whether it must wait for all the running programs, as it uses more boxes.
+void classify_request(const std::string& request, std::string& box, bool& runs, bool& exclusive) {
+    box.clear();
+    runs = false;
+    exclusive = false;
+    try {
+        json_value cmd = json_value::parse(request);
+        if (!cmd.is_object()) return;
+        if (cmd.has("box")) {
+            const json_value& id = cmd["box"];
+            box = id.is_number() ? std::to_string((long long)id.as_number()) : id.as_string();
+        }
+        std::string name = cmd["cmd"].as_string();
+        std::replace(name.begin(), name.end(), '-', '_');
+        runs = name == "run" || name == "run_many";
+        exclusive = name == "run_interactive";
+    } catch (std::exception& e) {
+        // Malformed commands are reported by handle_request.
+    }
+}
+
+std::string error_reply(const std::string& error) {
+    std::ostringstream out;
+    CottonJSONLogger reply_logger(out);
+    reply_logger.error(4, error);
+    reply_logger.write();
+    return out.str();
+}
+}
+
+size_t run_parallel_batch(const std::string& box_root, std::istream& in) {
+    CpuPool cpus;
+    std::vector<ParallelJob> jobs;
+    std::vector<std::string> replies;
+    std::vector<bool> replied;
+    size_t next_reply = 0;
+    auto flush_replies = [&] {
+        while (next_reply < replied.size() && replied[next_reply]) {
+            std::cout << replies[next_reply];
+            replies[next_reply].clear();
+            next_reply++;
+        }
+        std::cout.flush();
+    };
+    // Waits until at least one job finishes.
+    auto wait_job = [&] {
+        std::vector<struct pollfd> fds;
+        for (const auto& job: jobs) fds.push_back({job.sock, POLLIN, 0});
+        if (poll(fds.data(), fds.size(), -1) == -1) return;
+        for (size_t i=0; i<jobs.size(); i++) {
+            if (fds[i].revents == 0) continue;
+            char buf[4096];
+            ssize_t nread = read(jobs[i].sock, buf, sizeof buf);
+            if (nread > 0) jobs[i].reply.append(buf, nread);
+            if (nread > 0 || (nread == -1 && errno == EINTR)) continue;
+            close(jobs[i].sock);
+            while (waitpid(jobs[i].pid, nullptr, 0) == -1 && errno == EINTR);
+            cpus.release(jobs[i].cpu);
+            replies[jobs[i].index] = jobs[i].reply.empty() ? error_reply("The command was interrupted") : jobs[i].reply;
+            replied[jobs[i].index] = true;
+            jobs[i].pid = -1;
+        }
+        jobs.erase(std::remove_if(jobs.begin(), jobs.end(), [] (const ParallelJob& job) {
+            return job.pid == -1;
+        }), jobs.end());
+        flush_replies();
+    };
+    size_t executed = 0;
+    std::string line;
+    // The jobs get the boxes loaded so far along with the fork. Zygotes are
+    // left off: their children would belong to this process, and not to the
+    // job that waits for them.
+    set_box_cache(true);
+    hide_streams(true);
+    while (std::getline(in, line)) {
+        if (line.find_first_not_of(" \t\r") == std::string::npos) continue;
+        std::string box;
+        bool runs, exclusive;
+        classify_request(line, box, runs, exclusive);
+        if (cpus.size() == 0) runs = false;
+        size_t index = replies.size();
+        replies.emplace_back();
+        replied.push_back(false);
+        executed++;
+        auto box_busy = [&] {
+            return std::any_of(jobs.begin(), jobs.end(), [&box] (const ParallelJob& job) {
+                return !box.empty() && job.box == box;
+            });
+        };
+        while (box_busy() || (runs && !cpus.has_free()) || (exclusive && !jobs.empty())) wait_job();
+        if (!runs) {
+            std::ostringstream reply;
+            handle_request(box_root, line, reply);
+            replies[index] = reply.str();
+            replied[index] = true;
+            flush_replies();
+            continue;
+        }
+        int sv[2];
+        if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv) == -1) {
+            replies[index] = error_reply(serror("Error creating the socket"));
+            replied[index] = true;
+            flush_replies();
+            continue;
+        }
+        int cpu = cpus.acquire();
+        pid_t pid = fork();
+        if (pid == 0) {
+            close(sv[0]);
+            set_run_cpu(cpu);
+            std::ostringstream reply;
+            handle_request(box_root, line, reply);
+            send_all(sv[1], reply.str().data(), reply.str().size());
+            _exit(0);
+        }
+        close(sv[1]);
+        if (pid == -1) {
+            close(sv[0]);
+            cpus.release(cpu);
+            replies[index] = error_reply(serror("Error starting the command"));
+            replied[index] = true;
+            flush_replies();
+            continue;
+        }
+        jobs.push_back({pid, sv[0], cpu, box, index, ""});
+    }
+    while (!jobs.empty()) wait_job();
+    flush_replies();
+    set_box_cache(false);
+    hide_streams(false);
+    return executed;
+}
+#endif
+
+#endif
@@ -1,5 +1,9 @@
 #include "simple_json.hpp"
 #include <boost/algorithm/string/replace.hpp>
+#include <stdexcept>
+#include <cstring>
+#include <cstdlib>
+#include <cctype>
 
 template<>
 json_raw_string to_json(const bool& val) {
@@ -11,6 +15,9 @@ json_raw_string to_json(const std::string& val) {
     std::string res = val;
     boost::replace_all(res, "\\", "\\\\");
     boost::replace_all(res, "\"", "\\\"");
+    boost::replace_all(res, "\n", "\\n");
+    boost::replace_all(res, "\r", "\\r");
+    boost::replace_all(res, "\t", "\\t");
     res = '"' + res + '"';
     return res;
 }
@@ -23,3 +30,189 @@ json_raw_string to_json(const json_raw_string& val) {
 json_raw_string to_json_obj_rec() {
     return "";
 }
+
+class json_parser {
+    const std::string& str;
+    size_t pos = 0;
+    [[noreturn]] void fail(const std::string& what) const {
+        throw std::runtime_error("Invalid JSON at position " + std::to_string(pos) + ": " + what);
+    }
+    void skip_spaces() {
+        while (pos < str.size() && isspace((unsigned char)str[pos])) pos++;
+    }
+    char peek() {
+        skip_spaces();
+        if (pos == str.size()) fail("unexpected end of input");
+        return str[pos];
+    }
+    void expect(char c) {
+        if (peek() != c) fail(std::string("expected '") + c + "'");
+        pos++;
+    }
+    void expect_word(const char* word) {
+        size_t len = strlen(word);
+        if (str.compare(pos, len, word) != 0) fail("unexpected token");
+        pos += len;
+    }
+    static void append_utf8(std::string& res, unsigned cp) {
+        if (cp < 0x80) {
+            res += (char)cp;
+        } else if (cp < 0x800) {
+            res += (char)(0xC0 | (cp >> 6));
+            res += (char)(0x80 | (cp & 0x3F));
+        } else if (cp < 0x10000) {
+            res += (char)(0xE0 | (cp >> 12));
+            res += (char)(0x80 | ((cp >> 6) & 0x3F));
+            res += (char)(0x80 | (cp & 0x3F));
+        } else {
+            res += (char)(0xF0 | (cp >> 18));
+            res += (char)(0x80 | ((cp >> 12) & 0x3F));
+            res += (char)(0x80 | ((cp >> 6) & 0x3F));
+            res += (char)(0x80 | (cp & 0x3F));
+        }
+    }
+    unsigned parse_hex4() {
+        if (pos + 4 > str.size()) fail("truncated unicode escape");
+        unsigned cp = 0;
+        for (int i=0; i<4; i++) {
+            char c = str[pos++];
+            cp <<= 4;
+            if (c >= '0' && c <= '9') cp |= c - '0';
+            else if (c >= 'a' && c <= 'f') cp |= c - 'a' + 10;
+            else if (c >= 'A' && c <= 'F') cp |= c - 'A' + 10;
+            else fail("invalid unicode escape");
+        }
+        return cp;
+    }
+    std::string parse_string() {
+        expect('"');
+        std::string res;
+        while (true) {
+            if (pos == str.size()) fail("unterminated string");
+            char c = str[pos++];
+            if (c == '"') break;
+            if (c != '\\') {
+                res += c;
+                continue;
+            }
+            if (pos == str.size()) fail("unterminated string");
+            c = str[pos++];
+            switch (c) {
+                case '"': res += '"'; break;
+                case '\\': res += '\\'; break;
+                case '/': res += '/'; break;
+                case 'b': res += '\b'; break;
+                case 'f': res += '\f'; break;
+                case 'n': res += '\n'; break;
+                case 'r': res += '\r'; break;
+                case 't': res += '\t'; break;
+                case 'u': {
+                    unsigned cp = parse_hex4();
+                    if (cp >= 0xD800 && cp < 0xDC00 && str.compare(pos, 2, "\\u") == 0) {
+                        pos += 2;
+                        unsigned low = parse_hex4();
+                        cp = 0x10000 + ((cp - 0xD800) << 10) + (low - 0xDC00);
+                    }
+                    append_utf8(res, cp);
+                    break;
+                }
+                default: fail("invalid escape sequence");
+            }
+        }
+        return res;
+    }
+    json_value parse_value() {
+        json_value res;
+        char c = peek();
+        if (c == '{') {
+            pos++;
+            res.type_ = json_value::object_type;
+            if (peek() == '}') {
+                pos++;
+                return res;
+            }
+            while (true) {
+                std::string key = parse_string();
+                expect(':');
+                res.object_[key] = parse_value();
+                if (peek() == '}') break;
+                expect(',');
+            }
+            pos++;
+        } else if (c == '[') {
+            pos++;
+            res.type_ = json_value::array_type;
+            if (peek() == ']') {
+                pos++;
+                return res;
+            }
+            while (true) {
+                res.array_.push_back(parse_value());
+                if (peek() == ']') break;
+                expect(',');
+            }
+            pos++;
+        } else if (c == '"') {
+            res.type_ = json_value::string_type;
+            res.string_ = parse_string();
+        } else if (c == 't') {
+            expect_word("true");
+            res.type_ = json_value::bool_type;
+            res.bool_ = true;
+        } else if (c == 'f') {
+            expect_word("false");
+            res.type_ = json_value::bool_type;
+        } else if (c == 'n') {
+            expect_word("null");
+        } else {
+            const char* begin = str.c_str() + pos;
+            char* end;
+            res.number_ = strtod(begin, &end);
+            if (end == begin) fail("unexpected token");
+            res.type_ = json_value::number_type;
+            pos += end - begin;
+        }
+        return res;
+    }
+public:
+    json_parser(const std::string& str): str(str) {}
+    json_value parse() {
+        json_value res = parse_value();
+        skip_spaces();
+        if (pos != str.size()) fail("trailing characters");
+        return res;
+    }
+};
+
+json_value json_value::parse(const std::string& str) {
+    return json_parser(str).parse();
+}
+
+bool json_value::as_bool() const {
+    if (type_ != bool_type) throw std::runtime_error("JSON value is not a boolean");
+    return bool_;
+}
+
+double json_value::as_number() const {
+    if (type_ != number_type) throw std::runtime_error("JSON value is not a number");
+    return number_;
+}
+
+const std::string& json_value::as_string() const {
+    if (type_ != string_type) throw std::runtime_error("JSON value is not a string");
+    return string_;
+}
+
+const std::vector<json_value>& json_value::as_array() const {
+    if (type_ != array_type) throw std::runtime_error("JSON value is not an array");
+    return array_;
+}
+
+bool json_value::has(const std::string& key) const {
+    return type_ == object_type && object_.count(key);
+}
+
+const json_value& json_value::operator[](const std::string& key) const {
+    if (!has(key)) throw std::runtime_error("Missing JSON field \"" + key + "\"");
+    return object_.at(key);
+}
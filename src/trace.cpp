@@ -0,0 +1,130 @@
+#include "trace.hpp"
+#include "simple_json.hpp"
+#include "util.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#ifdef COTTON_UNIX
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+namespace trace {
+namespace {
+const size_t max_events = 128;
+
+struct Buffer {
+    std::atomic<bool> active;
+    std::atomic<uint32_t> count;
+    Event events[max_events];
+};
+
+Buffer* map_buffer() {
+#ifdef COTTON_UNIX
+    // Mapped before any fork, so that every child writes to the same buffer.
+    void* mem = mmap(nullptr, sizeof(Buffer), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (mem != MAP_FAILED) return new (mem) Buffer();
+#endif
+    return new Buffer();
+}
+
+Buffer* const buffer = map_buffer();
+
+uint64_t now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1'000'000'000ULL + ts.tv_nsec;
+}
+
+int32_t current_pid() {
+#ifdef COTTON_UNIX
+    return getpid();
+#else
+    return 0;
+#endif
+}
+}
+
+void start() {
+    buffer->count = 0;
+    buffer->active = true;
+}
+
+void stop() {
+    buffer->active = false;
+}
+
+bool is_active() {
+    return buffer->active;
+}
+
+void begin(const char* name) {
+    if (!buffer->active) return;
+    uint32_t idx = buffer->count++;
+    if (idx >= max_events) return;
+    Event& ev = buffer->events[idx];
+    strncpy(ev.name, name, sizeof ev.name - 1);
+    ev.name[sizeof ev.name - 1] = 0;
+    ev.pid = current_pid();
+    ev.end = 0;
+    ev.start = now();
+}
+
+void end(const char* name) {
+    if (!buffer->active) return;
+    uint32_t count = std::min<uint32_t>(buffer->count, max_events);
+    for (uint32_t i=count; i>0; i--) {
+        Event& ev = buffer->events[i-1];
+        if (ev.end == 0 && strncmp(ev.name, name, sizeof ev.name - 1) == 0) {
+            ev.end = now();
+            return;
+        }
+    }
+}
+
+std::vector<Event> events() {
+    uint32_t count = std::min<uint32_t>(buffer->count, max_events);
+    std::vector<Event> ret(buffer->events, buffer->events + count);
+    std::stable_sort(ret.begin(), ret.end(), [](const Event& a, const Event& b) {return a.start < b.start;});
+    return ret;
+}
+
+std::vector<std::pair<std::string, double>> durations() {
+    std::vector<std::pair<std::string, double>> ret;
+    for (const auto& ev: events()) {
+        if (ev.end == 0) continue;
+        // The phases that repeat, as in run_many, are added up.
+        auto same = std::find_if(ret.begin(), ret.end(),
+            [&ev](const std::pair<std::string, double>& phase) {return phase.first == ev.name;});
+        if (same == ret.end()) same = ret.emplace(ret.end(), ev.name, 0);
+        same->second += (ev.end - ev.start) / 1000.0;
+    }
+    return ret;
+}
+
+std::string chrome_trace() {
+    auto evs = events();
+    uint64_t origin = evs.empty() ? 0 : evs[0].start;
+    std::vector<Event> done;
+    for (const auto& ev: evs)
+        if (ev.end != 0) done.push_back(ev);
+    return to_json_obj("traceEvents", to_json_arr(done, [origin](const Event& ev) {
+        return to_json_obj(
+            "name", std::string(ev.name),
+            "ph", std::string("X"),
+            "ts", (ev.start - origin) / 1000.0,
+            "dur", (ev.end - ev.start) / 1000.0,
+            "pid", ev.pid,
+            "tid", ev.pid
+        );
+    }), "displayTimeUnit", std::string("ms"));
+}
+
+bool write_chrome_trace(const std::string& path) {
+    std::ofstream fout(path);
+    fout << chrome_trace() << std::endl;
+    return bool(fout);
+}
+}
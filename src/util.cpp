@@ -6,35 +6,205 @@
 #include <sys/types.h>
 #include <fcntl.h>
 #include <dirent.h>
+#include <sys/file.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <algorithm>
+#include <condition_variable>
+#include <mutex>
+#include <queue>
+#include <thread>
 #include <vector>
+#ifdef COTTON_LINUX
+#include <sys/syscall.h>
+#endif
 
 std::string serror(const std::string& base, int err) {
     return base + ": " + strerror(err);
 }
 
-int rm_rf(const std::string& fld) {
-    DIR *cur = opendir(fld.c_str());
-    if (cur) {
-        struct dirent *dir;
-        while ((dir=readdir(cur))) {
-            if (strcmp(dir->d_name, ".") == 0 || strcmp(dir->d_name, "..") == 0) continue;
-            struct stat statbuf;
-            std::string entry = fld + "/" + dir->d_name;
-            if (stat(entry.c_str(), &statbuf) == -1) {
-                return errno;
-            } else {
-                int tmp;
-                if (S_ISDIR(statbuf.st_mode)) tmp = rm_rf(entry);
-                else tmp = unlink(entry.c_str());
-                if (tmp != 0) return errno;
-            }
+namespace {
+bool is_dot(const char* name) {
+    return name[0] == '.' && (name[1] == 0 || (name[1] == '.' && name[2] == 0));
+}
+
+bool is_dir(int dir_fd, const struct dirent* entry, int& err) {
+    if (entry->d_type != DT_UNKNOWN) return entry->d_type == DT_DIR;
+    struct stat info;
+    if (fstatat(dir_fd, entry->d_name, &info, AT_SYMLINK_NOFOLLOW) == -1) {
+        err = errno;
+        return false;
+    }
+    return S_ISDIR(info.st_mode);
+}
+
+int rm_at(int dir_fd, const char* name, bool dir);
+
+// Deletes everything inside the folder open as fd, and closes it.
+int rm_contents(int fd) {
+    DIR* cur = fdopendir(fd);
+    if (cur == nullptr) {
+        int err = errno;
+        close(fd);
+        return err;
+    }
+    int err = 0;
+    struct dirent* entry;
+    while (err == 0 && (entry = readdir(cur))) {
+        if (is_dot(entry->d_name)) continue;
+        bool dir = is_dir(dirfd(cur), entry, err);
+        if (err == 0) err = rm_at(dirfd(cur), entry->d_name, dir);
+    }
+    closedir(cur);
+    return err;
+}
+
+int rm_at(int dir_fd, const char* name, bool dir) {
+    if (dir) {
+        int fd = openat(dir_fd, name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+        if (fd == -1) return errno;
+        int err = rm_contents(fd);
+        if (err) return err;
+    }
+    if (unlinkat(dir_fd, name, dir ? AT_REMOVEDIR : 0) == -1) return errno;
+    return 0;
+}
+
+// Empties a folder with a pool of threads. Every thread takes a folder from
+// the queue, deletes the files in it and queues its subfolders; the folders
+// themselves are deleted at the end, deepest first.
+class ParallelRemover {
+    int root_fd;
+    std::mutex mtx;
+    std::condition_variable cv;
+    std::queue<std::string> pending;
+    std::vector<std::pair<size_t, std::string>> folders;
+    size_t active = 0;
+    int err = 0;
+
+    int scan(const std::string& path, std::vector<std::string>& subfolders) {
+        int fd = openat(root_fd, path.c_str(), O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+        if (fd == -1) return errno;
+        DIR* cur = fdopendir(fd);
+        if (cur == nullptr) {
+            int ret = errno;
+            close(fd);
+            return ret;
+        }
+        int ret = 0;
+        struct dirent* entry;
+        while (ret == 0 && (entry = readdir(cur))) {
+            if (is_dot(entry->d_name)) continue;
+            if (is_dir(dirfd(cur), entry, ret)) subfolders.push_back(path + "/" + entry->d_name);
+            else if (ret == 0 && unlinkat(dirfd(cur), entry->d_name, 0) == -1) ret = errno;
         }
         closedir(cur);
+        return ret;
+    }
+
+    void worker() {
+        std::unique_lock<std::mutex> lck(mtx);
+        while (true) {
+            cv.wait(lck, [this] {return err || !pending.empty() || active == 0;});
+            if (err || pending.empty()) break;
+            std::string path = pending.front();
+            pending.pop();
+            active++;
+            lck.unlock();
+            std::vector<std::string> subfolders;
+            int ret = scan(path, subfolders);
+            lck.lock();
+            active--;
+            if (ret) err = ret;
+            for (auto& sub: subfolders) {
+                folders.emplace_back(std::count(sub.begin(), sub.end(), '/'), sub);
+                pending.push(std::move(sub));
+            }
+            cv.notify_all();
+        }
+        cv.notify_all();
+    }
+
+public:
+    ParallelRemover(int root_fd): root_fd(root_fd) {}
+
+    int run(unsigned threads) {
+        pending.push(".");
+        std::vector<std::thread> pool;
+        for (unsigned i=0; i<threads; i++) pool.emplace_back(&ParallelRemover::worker, this);
+        for (auto& t: pool) t.join();
+        if (err) return err;
+        std::sort(folders.rbegin(), folders.rend());
+        for (auto& folder: folders)
+            if (unlinkat(root_fd, folder.second.c_str(), AT_REMOVEDIR) == -1) return errno;
+        return 0;
+    }
+};
+}
+
+int rm_rf(const std::string& fld, unsigned threads) {
+    int fd = open(fld.c_str(), O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    if (fd == -1) return errno;
+    int err;
+    if (threads <= 1) {
+        err = rm_contents(fd);
+    } else {
+        err = ParallelRemover(fd).run(threads);
+        close(fd);
     }
+    if (err) return err;
     if (rmdir(fld.c_str()) == -1) return errno;
     return 0;
 }
 
+int rm_rf_async(const std::string& fld, const std::string& trash_dir) {
+    static unsigned counter = 0;
+    if (mkdir(trash_dir.c_str(), 0755) == -1 && errno != EEXIST) return rm_rf(fld);
+    std::string target = trash_dir + "/" + std::to_string(getpid()) + "." +
+        std::to_string(std::chrono::steady_clock::now().time_since_epoch().count()) + "." +
+        std::to_string(counter++);
+    if (rename(fld.c_str(), target.c_str()) == -1) {
+        if (errno == ENOENT) return ENOENT;
+        return rm_rf(fld);
+    }
+    // Detach the reclaimer with a double fork, so that nobody has to wait it.
+    pid_t pid = fork();
+    if (pid == -1) return 0; // It will be deleted by the next reclaimer
+    if (pid == 0) {
+        if (fork() != 0) _exit(0);
+        setsid();
+        // Do not keep open the pipes and sockets of whoever is waiting for us.
+        int null_fd = open("/dev/null", O_RDWR);
+        for (int fd=0; fd<3; fd++) dup2(null_fd, fd);
+#if defined(COTTON_LINUX) && defined(SYS_close_range)
+        syscall(SYS_close_range, 3, ~0U, 0);
+#else
+        for (int fd=3; fd<1024; fd++) close(fd);
+#endif
+        nice(10);
+        int trash_fd = open(trash_dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        // Only one reclaimer at a time: what is trashed while it is running
+        // and after its last scan is left for the next one.
+        if (trash_fd == -1 || flock(trash_fd, LOCK_EX | LOCK_NB) == -1) _exit(0);
+        unsigned threads = std::max(1U, std::thread::hardware_concurrency() / 2);
+        bool found = true;
+        while (found) {
+            found = false;
+            DIR* trash = opendir(trash_dir.c_str());
+            if (trash == nullptr) break;
+            struct dirent* entry;
+            while ((entry = readdir(trash))) {
+                if (is_dot(entry->d_name)) continue;
+                found = rm_rf(trash_dir + "/" + entry->d_name, threads) == 0 || found;
+            }
+            closedir(trash);
+        }
+        _exit(0);
+    }
+    waitpid(pid, nullptr, 0);
+    return 0;
+}
+
 int mkdirs(const std::string& fld, mode_t mode) {
     std::vector<char> folder(fld.begin(), fld.end());
     folder.emplace_back(0);
@@ -50,6 +220,95 @@ int mkdirs(const std::string& fld, mode_t mode) {
     return 0;
 }
 
+bool read_all(int fd, void* buf, size_t len) {
+    char* pos = (char*)buf;
+    while (len > 0) {
+        ssize_t nread = read(fd, pos, len);
+        if (nread == -1 && errno == EINTR) continue;
+        if (nread <= 0) return false;
+        pos += nread;
+        len -= nread;
+    }
+    return true;
+}
+
+bool send_all(int fd, const void* buf, size_t len) {
+    const char* pos = (const char*)buf;
+    while (len > 0) {
+        ssize_t nwritten = send(fd, pos, len, MSG_NOSIGNAL);
+        if (nwritten == -1 && errno == EINTR) continue;
+        if (nwritten <= 0) return false;
+        pos += nwritten;
+        len -= nwritten;
+    }
+    return true;
+}
+
+namespace {
+const size_t max_passed_fds = 8;
+}
+
+bool send_fds(int sock, const void* buf, size_t len, const int* fds, size_t count) {
+    if (count > max_passed_fds) {
+        errno = EINVAL;
+        return false;
+    }
+    char control[CMSG_SPACE(max_passed_fds * sizeof(int))] = {};
+    struct iovec iov = {const_cast<void*>(buf), len};
+    struct msghdr msg = {};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    if (count > 0) {
+        msg.msg_control = control;
+        msg.msg_controllen = CMSG_SPACE(count * sizeof(int));
+        struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(count * sizeof(int));
+        memcpy(CMSG_DATA(cmsg), fds, count * sizeof(int));
+    }
+    ssize_t nwritten;
+    while ((nwritten = sendmsg(sock, &msg, MSG_NOSIGNAL)) == -1 && errno == EINTR);
+    if (nwritten <= 0) return false;
+    // The descriptors travel with the first chunk, the rest is plain data.
+    return send_all(sock, (const char*)buf + nwritten, len - nwritten);
+}
+
+bool receive_fds(int sock, void* buf, size_t len, int* fds, size_t& count) {
+    char control[CMSG_SPACE(max_passed_fds * sizeof(int))] = {};
+    struct iovec iov = {buf, len};
+    struct msghdr msg = {};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof control;
+    ssize_t nread;
+    while ((nread = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC)) == -1 && errno == EINTR);
+    size_t received = 0;
+    for (struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); nread > 0 && cmsg != nullptr; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+        if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS) continue;
+        size_t n = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        for (size_t i=0; i<n; i++) {
+            int fd;
+            memcpy(&fd, CMSG_DATA(cmsg) + i * sizeof(int), sizeof(int));
+            if (received < count) fds[received++] = fd;
+            else close(fd);
+        }
+    }
+    count = received;
+    if (nread <= 0) return false;
+    return read_all(sock, (char*)buf + nread, len - nread);
+}
+
+int open_pidfd(pid_t pid) {
+#if defined(COTTON_LINUX) && defined(SYS_pidfd_open)
+    return syscall(SYS_pidfd_open, pid, 0);
+#else
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
 int Privileged::counter = 0;
 
 #endif
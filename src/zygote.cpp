@@ -0,0 +1,136 @@
+#include "util.hpp"
+#ifdef COTTON_LINUX
+#include "zygote.hpp"
+#include <map>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/prctl.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+bool Zygote::enabled_ = false;
+
+namespace {
+std::map<std::string, std::unique_ptr<Zygote>> zygotes;
+}
+
+void Zygote::set_enabled(bool enabled) {
+    enabled_ = enabled;
+    if (!enabled) zygotes.clear();
+}
+
+void Zygote::disable_after_fork() {
+    enabled_ = false;
+    for (auto& zygote: zygotes) zygote.second->pid = -1;
+    zygotes.clear();
+}
+
+Zygote* Zygote::get(const std::string& name, const std::string& key, unsigned long clone_flags,
+    const setup_t& setup, const child_t& child) {
+    auto zygote = zygotes.find(name);
+    if (zygote != zygotes.end()) {
+        if (zygote->second->key == key) return zygote->second.get();
+        zygotes.erase(zygote);
+    }
+    int sv[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv) == -1) return nullptr;
+    std::unique_ptr<Zygote> z(new Zygote());
+    pid_t parent = getpid();
+    z->pid = fork();
+    if (z->pid == 0) {
+        // Die with the process that uses us.
+        prctl(PR_SET_PDEATHSIG, SIGKILL);
+        if (getppid() != parent) _exit(0);
+        close(sv[0]);
+        z->sock = sv[1];
+        z->zygote_main(clone_flags, setup, child);
+    }
+    close(sv[1]);
+    if (z->pid == -1) {
+        close(sv[0]);
+        return nullptr;
+    }
+    z->sock = sv[0];
+    z->key = key;
+    int32_t status;
+    if (!read_all(z->sock, &status, sizeof status)) return nullptr;
+    if (status != 0) {
+        errno = status;
+        return nullptr;
+    }
+    Zygote* ret = z.get();
+    zygotes[name] = std::move(z);
+    return ret;
+}
+
+void Zygote::stop(const std::string& name) {
+    zygotes.erase(name);
+}
+
+[[noreturn]] void Zygote::zygote_main(unsigned long clone_flags, const setup_t& setup, const child_t& child) {
+    for (int sig = 1; sig < NSIG; sig++) ::signal(sig, SIG_DFL);
+    // The setup may need descriptors of the parent, such as its namespaces.
+    int32_t status = setup() ? 0 : (errno ? errno : EINVAL);
+    // Keep only the standard streams, which are inherited by the boxes, and
+    // the control socket.
+    dup2(sock, 3);
+    sock = 3;
+    fcntl(sock, F_SETFD, FD_CLOEXEC);
+#ifdef SYS_close_range
+    syscall(SYS_close_range, 4, ~0U, 0);
+#else
+    for (int fd=4; fd<1024; fd++) close(fd);
+#endif
+    send_all(sock, &status, sizeof status);
+    if (status != 0) _exit(1);
+    while (true) {
+        uint32_t len;
+        int received[8];
+        size_t fd_count = 8;
+        if (!receive_fds(sock, &len, sizeof len, received, fd_count)) _exit(0);
+        std::vector<int> fds(received, received + fd_count);
+        std::string request(len, 0);
+        if (!read_all(sock, &request[0], len)) _exit(0);
+        pid_t child_pid;
+        {
+            Privileged p;
+            child_pid = syscall(SYS_clone, CLONE_PARENT | clone_flags | SIGCHLD, 0, 0, 0, 0);
+        }
+        if (child_pid == 0) {
+            close(sock);
+            child(request, fds);
+            _exit(1);
+        }
+        int32_t reply = child_pid == -1 ? -errno : child_pid;
+        for (int fd: fds) close(fd);
+        if (!send_all(sock, &reply, sizeof reply)) _exit(0);
+    }
+}
+
+pid_t Zygote::spawn(const std::string& request, const std::vector<int>& fds) {
+    int32_t reply;
+    errno = 0;
+    uint32_t len = request.size();
+    if (!send_fds(sock, &len, sizeof len, fds.data(), fds.size()) || !send_all(sock, request.data(), request.size()) ||
+        !read_all(sock, &reply, sizeof reply)) {
+        if (errno == 0) errno = EPIPE;
+        return -1;
+    }
+    if (reply < 0) {
+        errno = -reply;
+        return -1;
+    }
+    return reply;
+}
+
+Zygote::~Zygote() {
+    if (sock != -1) close(sock);
+    if (pid > 0) {
+        kill(pid, SIGKILL);
+        while (waitpid(pid, nullptr, 0) == -1 && errno == EINTR);
+    }
+}
+
+#endif